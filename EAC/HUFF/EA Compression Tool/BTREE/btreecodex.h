@@ -46,6 +46,7 @@ int        GCALL BTREE_decode(void *dest, const void *compresseddata, int *compr
 #else
 int        GCALL BTREE_decode(void *dest, const void *compresseddata, int *compressedsize);
 #endif
+int        GCALL BTREE_decode_safe(void *dest, int destcap, const void *compresseddata, int compressedsize);
 
 /* Encode Functions */
 
@@ -117,6 +117,135 @@ static int BTREE_decompress(unsigned char *packbuf,unsigned char *unpackbuf)
     return(ulen);
 }
 
+/* expanded length of each node, 0 while it is being measured so a
+   node that contains itself is caught, as is one that contains the
+   clue.  Lengths are capped at limit. */
+
+static int BTREE_measure(struct BTreeDecodeContext *DC, int *explen, int node, int limit)
+{
+    int len;
+    int r;
+
+    if (!DC->cluetbl[node])
+        return(1);
+    if (DC->cluetbl[node]>0)
+        return(-1);
+    if (explen[node]>=0)
+        return(explen[node] ? explen[node] : -1);
+    explen[node] = 0;
+    len = BTREE_measure(DC,explen,DC->left[node],limit);
+    if (len<0)
+        return(-1);
+    r = BTREE_measure(DC,explen,DC->right[node],limit);
+    if (r<0)
+        return(-1);
+    len += r;
+    if (len>limit)
+        len = limit;
+    explen[node] = len;
+    return(len);
+}
+
+/* as BTREE_decompress, but the node table is checked once and every
+   code against the end of the data and of the output */
+
+static int BTREE_decompress_safe(unsigned char *packbuf, int packsize, unsigned char *unpackbuf, int unpackcap)
+{
+    int  node;
+    int  i;
+    int  nodes;
+    int  clue;
+    int ulen;
+    int explen[256];
+    unsigned char *s;
+    unsigned char *send;
+    unsigned char *dend;
+    signed char c;
+    unsigned int type;
+    struct BTreeDecodeContext DC;
+
+    s = packbuf;
+    send = packbuf+packsize;
+    DC.d = unpackbuf;
+
+    if (!s || !unpackbuf || packsize<2)
+        return(-1);
+
+    type = ggetm(s,2);
+    s += 2;
+
+    /* (skip nothing for 0x46fb) */
+    if (type==0x47fb)                       /* skip ulen */
+        s += 3;
+    if (send-s<5)
+        return(-1);
+
+    ulen = ggetm(s,3);
+    s += 3;
+    if (ulen>unpackcap)
+        return(-1);
+    dend = unpackbuf+ulen;
+
+    for (i=0;i<256;++i)                     /* 0 means a code is a leaf */
+    {
+        DC.cluetbl[i] = 0;
+        explen[i] = -1;
+    }
+
+    clue = *s++;
+    DC.cluetbl[clue] = 1;                   /* mark clue as special */
+
+    nodes = *s++;
+    if (send-s<nodes*3)
+        return(-1);
+    for (i=0;i<nodes;++i)
+    {   node = *s++;
+        DC.left[node]  = *s++;
+        DC.right[node] = *s++;
+        DC.cluetbl[node] = (signed char)-1;
+    }
+    for (i=0;i<256;++i)
+        if (DC.cluetbl[i]<0 && BTREE_measure(&DC,explen,i,unpackcap+1)<0)
+            return(-1);
+
+    for (;;)
+    {
+        if (s>=send)
+            return(-1);
+        node = (int) *s++;
+        c=DC.cluetbl[node];
+        if (!c)
+        {
+            if (DC.d>=dend)
+                return(-1);
+            *DC.d++ = (unsigned char) node;
+            continue;
+        }
+        if (c<0)
+        {
+            if (explen[node]>dend-DC.d)
+                return(-1);
+            BTREE_chase(&DC,DC.left[node]);
+            BTREE_chase(&DC,DC.right[node]);
+            continue;
+        }
+        if (s>=send)
+            return(-1);
+        node = (int) *s++;
+        if (node)
+        {
+            if (DC.d>=dend)
+                return(-1);
+            *DC.d++ = (char) node;
+            continue;
+        }
+        break;
+    }
+    if (DC.d!=dend)
+        return(-1);
+    return(ulen);
+}
+
 /****************************************************************/
 /*  Information Functions                                       */
 /****************************************************************/
@@ -161,5 +290,13 @@ int GCALL BTREE_decode(void *dest, const void *compresseddata, int *compressedsi
     return(BTREE_decompress((unsigned char *)compresseddata,(unsigned char *)dest));
 }
 
+/* returns the unpacked size, or -1 if the data is truncated or corrupt
+   or does not fit in destcap bytes */
+
+int GCALL BTREE_decode_safe(void *dest, int destcap, const void *compresseddata, int compressedsize)
+{
+    return(BTREE_decompress_safe((unsigned char *)compresseddata,compressedsize,(unsigned char *)dest,destcap));
+}
+
 #endif
 
@@ -2,83 +2,215 @@
 
 #pragma hdrstop
 
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 #include "comp_encode.h"
 //---------------------------------------------------------------------------
 #pragma package(smart_init)
 
-int COMP_Encoder::COMP_encode(const unsigned char *src, int sourcesize, unsigned char *out)
+int COMP_Encoder::COMP_encode(const unsigned char *src, int sourcesize, unsigned char *out, int level)
 {
-	int pos = 0, out_size = 0;
+	out_data = out;
+	out_size = 0;
+	flagsPos = 0;
+	flagBit = 0;
+	flags = 0;
+
+	if (level == COMP_LEVEL_MAX)
+	{
+		if (!encodeOptimal(src, sourcesize))
+			return 0;
+		endCommands();
+		return out_size;
+	}
+
+	int pos = 0;
+	MATCHFINDER mf;
+	MFMATCH matches[MaxSearchDepth];
+
+	if (!MF_init(&mf, MF_BINTREE, MaxOffset, MaxSearchDepth, MinMatchLength, MaxMatchLength, MaxMatchLength, sourcesize))
+		return 0;
+	MF_reset(&mf, src);
 
 	while (pos < sourcesize)
 	{
-		uint16_t flags = 0;
-		int flagBit = 0;
-		size_t flagsPos = out_size;
+		int bestLen = 0;
+		int bestOff = 0;
 
-		out[out_size++] = 0; //placeholder
-		out[out_size++] = 0;
+		//the last match found is the longest one
+		int nummatch = MF_find(&mf, pos, sourcesize, matches);
+		if (nummatch)
+		{
+			bestLen = matches[nummatch - 1].len;
+			bestOff = matches[nummatch - 1].dist;
+		}
 
-		uint8_t chunk[48];
-		int chunk_sz = 0;
+		if (bestLen >= MinMatchLength)
+		{
+			putMatch(bestOff, bestLen);
+			for (int k = 1; k < bestLen; k++)
+				MF_skip(&mf, pos + k, sourcesize);
+			pos += bestLen;
+		}
+		else
+		{
+			putLiteral(src[pos++]);
+		}
+	}
+	endCommands();
+	MF_free(&mf);
+	return out_size;
+}
 
-		for (int i = 0; i < 16 && pos < sourcesize; i++)
+//Every literal costs 8 bits and every match 16, plus one flag bit each,
+//whatever the length or offset of the match. The cheapest parse of each
+//block is found by a forward pass over all match lengths and a walk back.
+//The pass looks OptLookahead bytes past the block so the parse does not
+//have to end on the block boundary; the matches found there are kept
+//for the next block.
+bool COMP_Encoder::encodeOptimal(const unsigned char *src, int sourcesize)
+{
+	struct OptNode
+	{
+		unsigned int price;
+		int len;
+		int dist;
+	};
+	const int nodes = OptBlockSize + OptLookahead;
+	MATCHFINDER mf;
+	MFMATCH matches[OptSearchDepth];
+	OptNode *node = (OptNode*)malloc((nodes + MaxMatchLength + 1) * sizeof(OptNode));
+	MFMATCH *longest = (MFMATCH*)malloc(nodes * sizeof(MFMATCH));
+
+	if (!node || !longest || !MF_init(&mf, MF_BINTREE, MaxOffset, OptSearchDepth, MinMatchLength, MaxMatchLength, MaxMatchLength, sourcesize))
+	{
+		free(longest);
+		free(node);
+		return false;
+	}
+	MF_reset(&mf, src);
+
+	int found = 0;
+	for (int pos = 0; pos < sourcesize; )
+	{
+		int last = sourcesize - pos;
+		if (last > nodes)
+			last = nodes;
+
+		//the longest match at each position, a prefix of it is a match as well
+		for (; found < last; found++)
 		{
-			int bestLen = 0;
-			int bestOff = 0;
+			int nummatch = MF_find(&mf, pos + found, sourcesize, matches);
+			longest[found].len = nummatch ? matches[nummatch - 1].len : 0;
+			longest[found].dist = nummatch ? matches[nummatch - 1].dist : 0;
+		}
 
-			//int start = std::max(0, pos - 4095);
-			int start = (pos > 4095) ? int(pos - 4095) : 0;
+		node[0].price = 0;
+		node[0].len = 0;
+		for (int i = 1; i <= last + MaxMatchLength; i++)
+			node[i].price = 0xFFFFFFFF;
 
-			for (int j = start; j < pos; j++)
+		for (int i = 0; i < last; i++)
+		{
+			unsigned int price = node[i].price + 9;
+			if (price < node[i + 1].price)
 			{
-				int k = 0;
-				while (k < 18 &&
-					   pos + k < sourcesize &&
-					   j + k < sourcesize && srcsrc[j + k] == src[pos + k])
-				{
-					k++;
-				}
+				node[i + 1].price = price;
+				node[i + 1].len = 0;
+			}
 
-				if (k > bestLen)
+			//on a tie take the later match, so a parse forced to end at
+			//the end of the pass leaves its short commands there
+			price = node[i].price + 17;
+			for (int len = MinMatchLength; len <= longest[i].len; len++)
+			{
+				if (price <= node[i + len].price)
 				{
-					bestLen = k;
-					bestOff = pos - j;
+					node[i + len].price = price;
+					node[i + len].len = len;
+					node[i + len].dist = longest[i].dist;
 				}
 			}
+		}
 
-			if (bestLen >= 3)
-			{
-				flags |= (1 << flagBit);
+		//walk back from the end of the pass, marking the path forward
+		int i = last, next = 0;
+		while (i > 0)
+		{
+			int len = node[i].len ? node[i].len : 1;
+			node[i].price = next; //reuse as forward link
+			next = i;
+			i -= len;
+		}
 
-				int length = bestLen;
-				int offset = bestOff;
+		//emit the path up to the end of the block, or all of it at the end of the data
+		int stop = (pos + last == sourcesize) ? last : OptBlockSize;
+		for (i = 0; i < stop; )
+		{
+			if (node[next].len)
+				putMatch(node[next].dist, node[next].len);
+			else
+				putLiteral(src[pos + i]);
+			i = next;
+			next = node[next].price;
+		}
 
-				uint8_t c = ((offset >> 4) & 0xF0) | ((length - 3) & 0x0F);
-				uint8_t d = offset & 0xFF;
+		//keep the matches already found past the block
+		found = last - i;
+		memmove(longest, longest + i, found * sizeof(MFMATCH));
+		pos += i;
+	}
+	MF_free(&mf);
+	free(longest);
+	free(node);
+	return true;
+}
 
-				chunk[chunk_sz++] = c;
-				chunk[chunk_sz++] = d;
-				pos += length;
-			}
-			else
-			{
-				chunk[chunk_sz++] = src[pos++];
-			}
+void COMP_Encoder::putLiteral(unsigned char c)
+{
+	if (flagBit == 16)
+		endCommands();
+	if (flagBit == 0)
+	{
+		flagsPos = out_size;
+		out_data[out_size++] = 0; //placeholder
+		out_data[out_size++] = 0;
+	}
+	out_data[out_size++] = c;
+	flagBit++;
+}
 
-			flagBit++;
-		}
+void COMP_Encoder::putMatch(int offset, int length)
+{
+	if (flagBit == 16)
+		endCommands();
+	if (flagBit == 0)
+	{
+		flagsPos = out_size;
+		out_data[out_size++] = 0; //placeholder
+		out_data[out_size++] = 0;
+	}
+	flags |= (1 << flagBit);
+
+	uint8_t c = ((offset >> 4) & 0xF0) | ((length - 3) & 0x0F);
+	uint8_t d = offset & 0xFF;
 
-		// write flags
-		out[flagsPos + 0] = flags & 0xFF;
-		out[flagsPos + 1] = (flags >> 8) & 0xFF;
+	out_data[out_size++] = c;
+	out_data[out_size++] = d;
+	flagBit++;
+}
 
-		//write data
-		unsigned char *o = out + out_size;
-		memcpy(o, chunk, chunk_sz);
-		out_size += chunk_sz;
+//write the flag word of the current group of commands
+void COMP_Encoder::endCommands()
+{
+	if (flagBit)
+	{
+		out_data[flagsPos + 0] = flags & 0xFF;
+		out_data[flagsPos + 1] = (flags >> 8) & 0xFF;
 	}
-	return out_size;
+	flags = 0;
+	flagBit = 0;
 }
 
 void COMP_Encoder::COMP_createHeader(unsigned char *hdr, int usize, int zsize)
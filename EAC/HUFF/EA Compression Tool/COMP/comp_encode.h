@@ -6,11 +6,39 @@
 #endif
 
 #pragma once
+#include <stdint.h>
+#include "matchfind.h"
+
+//level of COMP_encode
+#define COMP_LEVEL_NORMAL	0	//greedy parse
+#define COMP_LEVEL_MAX		1	//optimal parse, best ratio, slower
+
 class COMP_Encoder
 {
 	private: int COMP_MagicID = 0x504D4F43;
     private: int version = 0x00001001;
 
-	public: int COMP_encode(const unsigned char *src, int sourcesize, unsigned char *out);
+	//a match is 12 bits of offset and 4 bits of length
+	private: static const int MaxOffset = 4095;
+	private: static const int MinMatchLength = 3;
+	private: static const int MaxMatchLength = 18;
+	private: static const int MaxSearchDepth = 48;
+	private: static const int OptSearchDepth = 256;
+	private: static const int OptBlockSize = 4096;
+	private: static const int OptLookahead = 256;
+
+	//command writer state, 16 commands share a flag word
+	private: unsigned char *out_data;
+	private: int out_size;
+	private: int flagsPos;
+	private: int flagBit;
+	private: uint16_t flags;
+
+	private: void putLiteral(unsigned char c);
+	private: void putMatch(int offset, int length);
+	private: void endCommands();
+	private: bool encodeOptimal(const unsigned char *src, int sourcesize);
+
+	public: int COMP_encode(const unsigned char *src, int sourcesize, unsigned char *out, int level = COMP_LEVEL_NORMAL);
 	public: void COMP_createHeader(unsigned char *hdr, int usize, int zsize);
 };
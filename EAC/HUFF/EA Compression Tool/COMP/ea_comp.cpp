@@ -2,18 +2,42 @@
 
 #pragma hdrstop
 
+#include <string.h>
 #include "ea_comp.h"
 //---------------------------------------------------------------------------
 #pragma package(smart_init)
 
-int COMP_Decompress(unsigned char *in, int insz, unsigned char *out, int outsz) {
-	unsigned char   *inl = in + insz;
+//copy a match of length bytes, 3 to 18, from t back, writing nothing
+//past it: a corrupt stream can have t 0, which leaves the bytes there as
+//they were. Matches 8 or more back go 8 bytes at a time, or 4 if they
+//are short, the last chunk overlapping the ones before. Nearer ones go
+//a byte at a time, in order, so a copy of the bytes just written
+//repeats them as the simple loop does.
+static unsigned char *COMP_CopyMatch(unsigned char *o, unsigned int t, unsigned int length) {
+    unsigned char   *ref = o - t;
+    unsigned int    i;
+
+    if(t >= 8 && length >= 8) {
+        memcpy(o, ref, 8);
+        if(length > 16) memcpy(o + 8, ref + 8, 8);
+        memcpy(o + length - 8, ref + length - 8, 8);
+    } else if(t >= 8 && length >= 4) {
+        memcpy(o, ref, 4);
+        memcpy(o + length - 4, ref + length - 4, 4);
+    } else if(t == 1) {
+        memset(o, *ref, length);
+    } else if(t) {
+        for(i = 0; i < length; i++) o[i] = ref[i];
+    }
+    return o + length;
+}
+
+//one command at a time, the plain loop COMP_Decompress was. It goes on
+//from o and the flags left, so the fast loop can hand it the last bytes.
+static int COMP_Decompress_Tail(unsigned char *in, unsigned char *inl, unsigned char *out, unsigned char *o, unsigned char *outl, unsigned int flags) {
     unsigned char   c, *back_ptr;
     unsigned int    cycles;
-    unsigned int    flags  = 1;
     int             i;
-    unsigned char   *o = out;
-    unsigned char   *outl = out + outsz;
 
     while((in < inl) && (o < outl)) {
         if(flags == 1) {
@@ -37,3 +61,35 @@ int COMP_Decompress(unsigned char *in, int insz, unsigned char *out, int outsz)
     }
     return o - out;
 }
+
+//kept as the reference for COMP_Decompress and for the benchmark
+int COMP_Decompress_Simple(unsigned char *in, int insz, unsigned char *out, int outsz) {
+    return COMP_Decompress_Tail(in, in + insz, out, out, out + outsz, 1);
+}
+
+//The same output and return as COMP_Decompress_Simple. A group of 16
+//commands takes at most 34 bytes of input and writes at most 288 bytes,
+//so while both are left it runs with no checks and each match is copied
+//at once. The simple loop takes over for the last bytes.
+int COMP_Decompress(unsigned char *in, int insz, unsigned char *out, int outsz) {
+    unsigned char   *inl = in + insz;
+    unsigned char   *o = out;
+    unsigned char   *outl = out + outsz;
+    unsigned int    flags, t;
+
+    while((inl - in >= 34) && (outl - o >= 16 * 18)) {
+        flags = (*in | (in[1] << 8)) | 0x10000;
+        in += 2;
+        do {
+            if(flags & 1) {
+                t = in[1] | ((in[0] & 0xF0) << 4);
+                o = COMP_CopyMatch(o, t, (in[0] & 0xF) + 3);
+                in += 2;
+            } else {
+                *o++ = *in++;
+            }
+            flags >>= 1;
+        } while(flags != 1);
+    }
+    return COMP_Decompress_Tail(in, inl, out, o, outl, 1);
+}
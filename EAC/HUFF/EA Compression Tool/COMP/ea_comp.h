@@ -4,6 +4,8 @@
 #define ea_compH
 
 int COMP_Decompress(unsigned char *in, int insz, unsigned char *out, int outsz);
+//the same result with every byte checked, for comparison
+int COMP_Decompress_Simple(unsigned char *in, int insz, unsigned char *out, int outsz);
 
 //---------------------------------------------------------------------------
 #endif
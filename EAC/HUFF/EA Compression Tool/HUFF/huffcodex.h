@@ -46,15 +46,33 @@ int        GCALL HUFF_decode(void *dest, const void *compresseddata, int *compre
 #else
 int        GCALL HUFF_decode(void *dest, const void *compresseddata, int *compressedsize);
 #endif
+int        GCALL HUFF_decode_safe(void *dest, int destcap, const void *compresseddata, int compressedsize);
+int        GCALL HUFF_decode_fast(void *dest, int destcap, const void *compresseddata, int compressedsize);
+int        GCALL HUFF_decode_index(void *dest, int destcap, const void *compresseddata, int compressedsize, void *index, int *indexsize, int interval);
+int        GCALL HUFF_decode_mt(void *dest, int destcap, const void *compresseddata, int compressedsize, const void *index, int indexsize, int threads);
+int        GCALL HUFF_index_size(int unpackedsize, int interval);
 
 /* Encode Functions */
 
+/* opts[0] of HUFF_encode is 0, 1 or 2 for the 30fb, 32fb and 34fb
+   types.  With HUFF_OPT_4STREAMS or'd in it writes the 38fb, 3afb and
+   3cfb types: one code table and 4 streams, each of a quarter of the
+   data, that HUFF_decode_fast decodes side by side.  They are a little
+   larger and only this library reads them. */
+
+#define HUFF_OPT_4STREAMS   0x100
+
 #ifdef __cplusplus
 int        GCALL HUFF_encode(void *compresseddata, const void *source, int sourcesize, int *opts=0);
 #else
 int        GCALL HUFF_encode(void *compresseddata, const void *source, int sourcesize, int *opts);
 #endif
 
+/* HUFF_encode with the codes packed in 256 KB chunks over threads, 0 for
+   one per core.  The output is the same for any number of threads. */
+
+int        GCALL HUFF_encode_mt(void *compresseddata, const void *source, int sourcesize, int *opts, int threads);
+
 /****************************************************************/
 /*  Internal                                                    */
 /****************************************************************/
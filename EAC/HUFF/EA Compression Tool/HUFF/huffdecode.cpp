@@ -22,6 +22,8 @@
 #define __HUFREAD 1
 
 #include <string.h>
+#include <atomic>
+#include <thread>
 #include "codex.h"
 #include "huffcodex.h"
 
@@ -505,6 +507,1586 @@ nextloop:
     return(ulen);
 }
 
+/****************************************************************/
+/*  Bounds Checked Huffman Unpacker                             */
+/****************************************************************/
+
+/* As HUFF_decompress, with the tables checked as they are read.  Bytes
+   past the end of the data read as 0 and a stream that reads more than
+   HUFFSAFEREAD bytes past it is rejected.  The output is checked on
+   every refill while more than HUFFSAFEMARGIN bytes are left (no refill
+   gives more than 33 codes) and on every code after that. */
+
+#define HUFFSAFEMARGIN  40
+#define HUFFSAFEREAD    4
+
+#undef GET16BITS
+#define GET16BITS() \
+    if (qs+2<=qsend)\
+    {\
+        bitsunshifted =  qs[0] | (bitsunshifted << 8);\
+        bitsunshifted =  qs[1] | (bitsunshifted << 8);\
+    }\
+    else\
+    {\
+        if (qs>=qsend+HUFFSAFEREAD)\
+            return(-1);\
+        bitsunshifted =  (qs<qsend ? qs[0] : 0) | (bitsunshifted << 8);\
+        bitsunshifted =  bitsunshifted << 8;\
+    }\
+    qs += 2;
+
+/* a run of zeros longer than any number can have is rejected (as in
+   HUFF64getnum), so the shifts below stay inside 32 bits */
+
+#undef SQgetnum
+#define SQgetnum(v) \
+    if ((int)bits<0)\
+    {\
+        SQgetbits(v,3);\
+        v -= 4;\
+    }\
+    else\
+    {\
+        int             n;\
+        unsigned int   v1;\
+\
+        if (bits>>16)\
+        {\
+            n=2;\
+            do\
+            {\
+                bits <<= 1; \
+                ++n;\
+            }\
+            while ((int)bits>=0);\
+            bits <<= 1;\
+            bitsleft -= (n-1);\
+            SQgetbits(v,ZERO);\
+        }\
+        else\
+        {\
+            n=2;\
+            do\
+            {\
+                ++n;\
+                SQgetbits(v,1);\
+                if (n>30)\
+                    return(-1);\
+            }\
+            while (!v);\
+        }\
+        if (n>16)\
+        {\
+            SQgetbits(v,n-16);\
+            SQgetbits(v1,16);\
+            v = (v1|(v<<16))+(1<<n)-4;\
+        }\
+        else\
+        {\
+            SQgetbits(v,n);\
+            v = (v+(1<<n)-4);\
+        }\
+    }
+
+static int HUFF_decompress_safe(unsigned char *packbuf, int packsize, unsigned char *unpackbuf, int unpackcap)
+{
+    unsigned int    type;
+    unsigned char   clue;
+    int            ulen;
+    unsigned int    cmp;
+    int             bitnum=0;
+    int             cluelen=0;
+    unsigned char   *qs;
+    unsigned char   *qd;
+    unsigned int   bits;
+    unsigned int   bitsunshifted=0;
+    int             numbits;
+    int             bitsleft;
+    unsigned int   v;
+    unsigned char   *qsend;
+    unsigned char   *qdend;
+    int             numcodes;
+
+    qs = packbuf;
+    qd = unpackbuf;
+    ulen = 0L;
+
+    if (qs && qd && packsize>=0)
+    {
+        qsend = packbuf+packsize;
+        {
+            int             mostbits;
+            int             i;
+            int             bitnumtbl[16];
+            unsigned int    deltatbl[16];
+            unsigned int    cmptbl[16];
+            unsigned char   codetbl[256];
+            unsigned char   quickcodetbl[256];
+            unsigned char   quicklentbl[256];
+
+            bitsleft = -16;                                 /* init bit stream */
+            bits = 0;
+            SQgetbits(v,ZERO);
+
+            SQgetbits(type,16);
+
+            if (type&0x8000) /* 4 byte size field */
+            {
+                /* (skip nothing for 0x30fb) */
+                if (type&0x100)                                 /* skip ulen */
+                {
+                    SQgetbits(v,16);
+                    SQgetbits(v,16);
+                }
+                type &= ~0x100;
+
+                SQgetbits(v,16);                                 /* unpack len */
+                SQgetbits(ulen,16);
+                ulen |= (v<<16);
+            }
+            else
+            {
+                /* (skip nothing for 0x30fb) */
+                if (type&0x100)                                 /* skip ulen */
+                {
+                    SQgetbits(v,8);
+                    SQgetbits(v,16);
+                }
+                type &= ~0x100;
+
+                SQgetbits(v,8);                                 /* unpack len */
+                SQgetbits(ulen,16);
+                ulen |= (v<<16);
+            }
+            if (ulen<0 || ulen>unpackcap)
+                return(-1);
+            qdend = unpackbuf+ulen;
+
+            {
+                {
+                    int numchars;
+
+                    {
+                        unsigned int basecmp;
+
+                        {
+                            unsigned int t;
+                            SQgetbits(t,8);                          /* clue byte */
+                            clue = (unsigned char)t;
+                        }
+
+                        numchars = 0;
+                        numbits = 1;
+                        basecmp = (unsigned int) 0;
+
+                        /* decode bitnums */
+
+                        do
+                        {
+                            if (numbits>15)
+                                return(-1);
+                            basecmp <<= 1;
+                            deltatbl[numbits] = basecmp-numchars;
+
+                            SQgetnum(bitnum);               /* # of codes of n bits */
+                            if (bitnum<0 || bitnum>256)
+                                return(-1);
+                            bitnumtbl[numbits] = bitnum;
+
+                            numchars += bitnum;
+                            basecmp += bitnum;
+
+                            cmp = 0;
+                            if (bitnum)                             /* left justify cmp */
+                                cmp = (basecmp << (16-numbits) & 0xffff);
+
+                            cmptbl[numbits++] = cmp;
+
+                        }
+                        while (!bitnum || cmp);                     /* n+1 bits in cmp? */
+                    }
+                    cmptbl[numbits-1] = 0xffffffff;               /* force match on most bits */
+
+                    mostbits = numbits-1;
+                    if (numchars>256)
+                        return(-1);
+                    numcodes = numchars;
+
+                    /* decode leapfrog code table */
+
+                    {
+                        signed char     leap[256];
+                        unsigned char   nextchar;
+
+                        SQmemset(leap,0,256);
+                        nextchar = (unsigned char) -1;
+
+                        for (i=0;i<numchars;++i)
+                        {
+                            int leapdelta=0;
+
+                            SQgetnum(leapdelta);
+                            ++leapdelta;
+                            if (leapdelta<1 || leapdelta>256-i)
+                                return(-1);
+
+                            do
+                            {
+                                ++nextchar;
+                                if (!leap[nextchar])
+                                    --leapdelta;
+                            } while (leapdelta);
+
+                            leap[nextchar] = 1;
+                            codetbl[i] = nextchar;
+                        }
+                    }
+                }
+
+/****************************************************************/
+/*  Make fast 8 tables                                          */
+/****************************************************************/
+
+                SQmemset(quicklentbl,64,256);
+
+                {
+                    int bits;
+                    int bitnum;
+                    int numbitentries;
+                    int nextcode;
+                    int nextlen;
+                    int i;
+                    unsigned char *codeptr;
+                    unsigned char *quickcodeptr;
+                    unsigned char *quicklenptr;
+
+                    codeptr = codetbl;
+                    quickcodeptr = quickcodetbl;
+                    quicklenptr = quicklentbl;
+
+                    for (bits=1; bits<=mostbits; ++bits)
+                    {
+                        bitnum = bitnumtbl[bits];
+                        if (bits>=9)
+                            break;
+                        numbitentries = 1<<(8-bits);
+                        if (bitnum*numbitentries>quickcodetbl+256-quickcodeptr)
+                            return(-1);
+
+                        while (bitnum--)
+                        {
+                            nextcode = *codeptr++;
+                            nextlen = bits;
+                            if (nextcode==clue)
+                            {
+                                cluelen = bits;
+                                nextlen = 96;                   /* will force out of main loop */
+                            }
+                            for (i=0; i<numbitentries; ++i)
+                            {
+                                *quickcodeptr++ = (unsigned char) nextcode;
+                                *quicklenptr++ = (unsigned char) nextlen;
+                            }
+                        }
+                    }
+                }
+            }
+
+/****************************************************************/
+/*  Main decoder                                                */
+/****************************************************************/
+
+            for (;;)
+            {
+                unsigned char   *quickcodeptr = quickcodetbl;
+                unsigned char   *quicklenptr  = quicklentbl;
+
+                goto nextloop;
+
+/* quick 8 fetch */
+
+                do
+                {
+
+                    *qd++ = quickcodeptr[bits>>24];
+                    GET16BITS();
+                    bits = bitsunshifted<<(16-bitsleft);
+
+/* quick 8 decode */
+
+nextloop:
+                    if (qdend-qd<HUFFSAFEMARGIN)
+                        goto nearend;
+                    numbits = quicklenptr[bits>>24];
+                    bitsleft -= numbits;
+
+                    if (bitsleft>=0)
+                    {
+                        do
+                        {
+                            *qd++ = quickcodeptr[bits>>24];
+                            bits <<= numbits;
+
+                            numbits = quicklenptr[bits>>24];
+                            bitsleft -= numbits;
+                            if (bitsleft<0) break;
+                            *qd++ = quickcodeptr[bits>>24];
+                            bits <<= numbits;
+
+                            numbits = quicklenptr[bits>>24];
+                            bitsleft -= numbits;
+                            if (bitsleft<0) break;
+                            *qd++ = quickcodeptr[bits>>24];
+                            bits <<= numbits;
+
+                            numbits = quicklenptr[bits>>24];
+                            bitsleft -= numbits;
+                            if (bitsleft<0) break;
+                            *qd++ = quickcodeptr[bits>>24];
+                            bits <<= numbits;
+
+                            numbits = quicklenptr[bits>>24];
+                            bitsleft -= numbits;
+
+                        } while (bitsleft>=0);
+                    }
+                    bitsleft += 16;
+
+                } while (bitsleft>=0);  /* would fetching 16 bits do it? */
+
+                bitsleft = bitsleft-16+numbits;   /* back to normal */
+                goto longcode;
+
+/* one code at a time, close to the end of the output */
+
+nearend:
+                numbits = quicklenptr[bits>>24];
+                if (numbits<=8)
+                {
+                    if (qd>=qdend)
+                        return(-1);
+                    *qd++ = quickcodeptr[bits>>24];
+                    bits <<= numbits;
+                    bitsleft -= numbits;
+                    if (bitsleft<0)
+                    {
+                        GET16BITS();
+                        bits = bitsunshifted<<-bitsleft;
+                        bitsleft += 16;
+                    }
+                    goto nextloop;
+                }
+longcode:
+
+/****************************************************************/
+/*  16 bit decoder                                              */
+/****************************************************************/
+
+                {
+                    unsigned char   code;
+
+
+                    if (numbits!=96)
+                    {
+                        cmp = (unsigned int) (bits>>16);  /* 16 bit left justified compare */
+
+                        numbits = 8;
+                        do
+                        {
+                            if (++numbits>mostbits)
+                                return(-1);
+                        }
+                        while (cmp>=cmptbl[numbits]);
+                    }
+                    else
+                        numbits = cluelen;
+
+
+                    cmp = bits >> (32-(numbits));
+                    bits <<= (numbits);
+                    bitsleft -= (numbits);
+
+                    if (cmp-deltatbl[numbits]>=(unsigned int)numcodes)
+                        return(-1);
+                    code = codetbl[cmp-deltatbl[numbits]];  /* the code */
+
+                    if (code!=clue && bitsleft>=0)
+                    {
+                        if (qd>=qdend)
+                            return(-1);
+                        *qd++ = code;
+                        goto nextloop;
+                    }
+
+                    if (bitsleft<0)
+                    {
+                        GET16BITS();
+                        bits = bitsunshifted<<-bitsleft;
+                        bitsleft += 16;
+                    }
+
+                    if (code!=clue)
+                    {
+                        if (qd>=qdend)
+                            return(-1);
+                        *qd++ = code;
+                        goto nextloop;
+                    }
+
+                    /* handle clue */
+
+                    {
+                        int    runlen=0;
+                        unsigned char *d=qd;
+                        unsigned char *dest;
+
+                        SQgetnum(runlen);
+                        if (runlen)                             /* runlength sequence */
+                        {
+                            if (d==unpackbuf || runlen<0 || runlen>qdend-d)
+                                return(-1);
+                            dest = d+runlen;
+                            code = *(d-1);
+                            do
+                            {
+                                *d++ = code;
+                            } while (d<dest);
+
+                            qd = d;
+                            goto nextloop;
+                        }
+                    }
+
+                    SQgetbits(v,1);                         /* End Of File */
+                    if (v)
+                        break;
+
+                    {
+                        unsigned int t;
+                        SQgetbits(t,8);                    /* explicite byte */
+                        code = (unsigned char)t;
+                    }
+                    if (qd>=qdend)
+                        return(-1);
+                    *qd++ = code;
+                    goto nextloop;
+                }
+
+            }
+            if (qd!=qdend)
+                return(-1);
+
+
+/****************************************************************/
+/*  Undelta                                                     */
+/****************************************************************/
+
+            {
+                unsigned int i;
+                unsigned int nextchar;
+
+                if (type==0x32fb || type==0xb2fb)                           /* deltaed? */
+                {
+                    i = 0;
+                    qd = unpackbuf;
+                    while (qd<unpackbuf+ulen)
+                    {
+                        i += *qd;
+                        *qd++ = (unsigned char) i;
+                    }
+                }
+                else if (type==0x34fb || type==0xb4fb)                      /* accelerated? */
+                {
+
+                    i = 0;
+                    nextchar = 0;
+                    qd = unpackbuf;
+                    while (qd<unpackbuf+ulen)
+                    {
+                        i += *qd;
+                        nextchar += i;
+                        *qd++ = (unsigned char) nextchar;
+                    }
+                }
+            }
+        }
+    }
+    return(ulen);
+}
+
+/****************************************************************/
+/*  64 Bit Huffman Unpacker                                     */
+/****************************************************************/
+
+/* As HUFF_decompress_safe, with the same output, but the bits are kept
+   in a 64 bit word refilled 8 bytes at a time, and every code up to
+   HUFF64BITS long is decoded by one lookup: the table entry holds the
+   byte and the length.  A second table holds as many as 3 codes per
+   entry, the ones that fit in HUFF64BITS bits, so the short codes of
+   data that packs well go several at a time, if most of its entries
+   hold more than one.  Either is read 5 times per refill.  Longer
+   codes, and the clue, go one at a time through the first table or the
+   cmptbl search as before.  Bytes past the end of the data read as 0
+   and a stream that reads more than HUFFSAFEREAD bytes past it is
+   rejected at the end. */
+
+#define HUFF64BITS      11
+#define HUFF64LONG      0x8000      /* longer than HUFF64BITS, search cmptbl */
+#define HUFF64CLUE      0x4000      /* the clue */
+
+struct HuffMulti
+{
+    unsigned char   code[4];    /* the bytes, the 4th only to copy 4 */
+    unsigned char   len;        /* bits of all of them */
+    unsigned char   count;      /* 0 if the first code is long or the clue */
+};
+
+struct HuffTables64
+{
+    unsigned char   clue;
+    int             mostbits;
+    int             numcodes;
+    int             multicodes;                 /* use multitbl */
+    unsigned int    deltatbl[16];
+    unsigned int    cmptbl[16];
+    unsigned char   codetbl[256];
+    unsigned short  fasttbl[1<<HUFF64BITS];
+    struct HuffMulti multitbl[1<<HUFF64BITS];
+};
+
+struct HuffBits64
+{
+    unsigned char   *qs;
+    unsigned char   *qsend;
+    unsigned long long bitbuf;
+    int             bitcount;
+};
+
+#define HUFF64fill(qs,qsend,bitbuf,bitcount) \
+    if (bitcount<=56)\
+    {\
+        if (qs+8<=qsend)\
+        {\
+            bitbuf |= (((unsigned long long) qs[0]<<56)\
+                    |  ((unsigned long long) qs[1]<<48)\
+                    |  ((unsigned long long) qs[2]<<40)\
+                    |  ((unsigned long long) qs[3]<<32)\
+                    |  ((unsigned long long) qs[4]<<24)\
+                    |  ((unsigned long long) qs[5]<<16)\
+                    |  ((unsigned long long) qs[6]<<8)\
+                    |  ((unsigned long long) qs[7])) >> bitcount;\
+            qs += (63-bitcount)>>3;\
+            bitcount |= 56;\
+        }\
+        else\
+        {\
+            do\
+            {\
+                bitbuf |= (unsigned long long) (qs<qsend ? *qs : 0) << (56-bitcount);\
+                ++qs;\
+                bitcount += 8;\
+            } while (bitcount<=56);\
+        }\
+    }
+
+#define HUFF64refill() HUFF64fill(qs,qsend,bitbuf,bitcount)
+
+/* n is 1 to 32 */
+#define HUFF64getbits(v,n) \
+    HUFF64refill();\
+    v = (unsigned int) (bitbuf >> (64-(n)));\
+    bitbuf <<= (n);\
+    bitcount -= (n);
+
+/* SQgetnum on the 64 bit word.  SQgetnum counts the 1 that ends the
+   zeros in n when it is not within the next 16 bits, and so does this. */
+#define HUFF64getnum(v) \
+    HUFF64refill();\
+    if ((long long) bitbuf<0)\
+    {\
+        HUFF64getbits(v,3);\
+        v -= 4;\
+    }\
+    else\
+    {\
+        int             n;\
+\
+        if (bitbuf>>48)\
+        {\
+            n = 2;\
+            do\
+            {\
+                bitbuf <<= 1;\
+                ++n;\
+            }\
+            while ((long long) bitbuf>=0);\
+            bitbuf <<= 1;\
+            bitcount -= (n-1);\
+        }\
+        else\
+        {\
+            n = 2;\
+            do\
+            {\
+                ++n;\
+                HUFF64getbits(v,1);\
+                if (n>30)\
+                    return(-1);\
+            }\
+            while (!v);\
+        }\
+        if (n>30)\
+            return(-1);\
+        HUFF64getbits(v,n);\
+        v = (v+(1<<n)-4);\
+    }
+
+/* the locals the macros work on, to and from a HuffBits64 */
+#define HUFF64load(b) \
+    qs = (b)->qs;\
+    qsend = (b)->qsend;\
+    bitbuf = (b)->bitbuf;\
+    bitcount = (b)->bitcount;
+
+#define HUFF64store(b) \
+    (b)->qs = qs;\
+    (b)->bitbuf = bitbuf;\
+    (b)->bitcount = bitcount;
+
+/* bytes read so far, counting a partly read one */
+#define HUFF64used(b,start) ((int) ((b)->qs-(start))-((b)->bitcount>>3))
+
+/* the header up to the code tables, and the tables made from them */
+
+static int HUFF64_header(struct HuffBits64 *b, struct HuffTables64 *t, unsigned int *ptype, int *pulen)
+{
+    unsigned int    type;
+    int             ulen;
+    unsigned int    cmp;
+    int             bitnum;
+    int             bitnumtbl[16];
+    int             numbits;
+    int             i;
+    unsigned int    v;
+    unsigned char   *qs;
+    unsigned char   *qsend;
+    unsigned long long bitbuf;
+    int             bitcount;
+
+    HUFF64load(b);
+
+    HUFF64getbits(type,16);
+
+    if (type&0x8000) /* 4 byte size field */
+    {
+        if (type&0x100)                                 /* skip ulen */
+        {
+            HUFF64getbits(v,32);
+        }
+        type &= ~0x100;
+        HUFF64getbits(v,32);                            /* unpack len */
+        ulen = (int) v;
+    }
+    else
+    {
+        if (type&0x100)                                 /* skip ulen */
+        {
+            HUFF64getbits(v,24);
+        }
+        type &= ~0x100;
+        HUFF64getbits(v,24);                            /* unpack len */
+        ulen = (int) v;
+    }
+
+    {
+        int             numchars;
+        unsigned int    basecmp;
+
+        HUFF64getbits(v,8);                             /* clue byte */
+        t->clue = (unsigned char) v;
+
+        numchars = 0;
+        numbits = 1;
+        basecmp = 0;
+
+        /* decode bitnums */
+
+        do
+        {
+            if (numbits>15)
+                return(-1);
+            basecmp <<= 1;
+            t->deltatbl[numbits] = basecmp-numchars;
+
+            HUFF64getnum(v);                            /* # of codes of n bits */
+            bitnum = (int) v;
+            if (bitnum<0 || bitnum>256)
+                return(-1);
+            bitnumtbl[numbits] = bitnum;
+
+            numchars += bitnum;
+            basecmp += bitnum;
+
+            cmp = 0;
+            if (bitnum)                                 /* left justify cmp */
+                cmp = (basecmp << (16-numbits) & 0xffff);
+
+            t->cmptbl[numbits++] = cmp;
+        }
+        while (!bitnum || cmp);                         /* n+1 bits in cmp? */
+
+        t->cmptbl[numbits-1] = 0xffffffff;              /* force match on most bits */
+        t->mostbits = numbits-1;
+        if (numchars>256)
+            return(-1);
+        t->numcodes = numchars;
+
+        /* decode leapfrog code table */
+
+        {
+            signed char     leap[256];
+            unsigned char   nextchar;
+            int             leapdelta;
+
+            memset(leap,0,256);
+            nextchar = (unsigned char) -1;
+
+            for (i=0;i<numchars;++i)
+            {
+                HUFF64getnum(v);
+                leapdelta = (int) v+1;
+                if (leapdelta<1 || leapdelta>256-i)
+                    return(-1);
+
+                do
+                {
+                    ++nextchar;
+                    if (!leap[nextchar])
+                        --leapdelta;
+                } while (leapdelta);
+
+                leap[nextchar] = 1;
+                t->codetbl[i] = nextchar;
+            }
+        }
+    }
+    HUFF64store(b);
+
+    /* fast table: the codes up to HUFF64BITS long in order, as the quick
+       8 tables, the rest of the entries searched */
+
+    {
+        int             bits;
+        int             entries;
+        int             entry;
+        unsigned short  *fastptr = t->fasttbl;
+        unsigned char   *codeptr = t->codetbl;
+
+        for (bits=1; bits<=t->mostbits && bits<=HUFF64BITS; ++bits)
+        {
+            bitnum = bitnumtbl[bits];
+            entries = 1<<(HUFF64BITS-bits);
+            if (bitnum*entries>t->fasttbl+(1<<HUFF64BITS)-fastptr)
+                return(-1);
+            while (bitnum--)
+            {
+                entry = (bits<<8) | *codeptr;
+                if (*codeptr==t->clue)
+                    entry |= HUFF64CLUE;
+                ++codeptr;
+                for (i=0; i<entries; ++i)
+                    *fastptr++ = (unsigned short) entry;
+            }
+        }
+        while (fastptr<t->fasttbl+(1<<HUFF64BITS))
+            *fastptr++ = HUFF64LONG;
+    }
+
+    /* multi table: the codes after the first as long as they are whole
+       within the HUFF64BITS bits, up to 3 and never the clue, which only
+       comes first, as does a long code, and then stops the fast loop */
+
+    {
+        unsigned int    next;
+        int             len;
+        int             count;
+        int             p;
+
+        t->multicodes = 0;
+        for (p=0; p<(1<<HUFF64BITS); ++p)
+        {
+            next = t->fasttbl[p];
+            t->multitbl[p].count = 0;
+            if (next&(HUFF64LONG|HUFF64CLUE))
+                continue;
+            len = 0;
+            count = 0;
+            do
+            {
+                t->multitbl[p].code[count++] = (unsigned char) next;
+                len += next>>8;
+                next = t->fasttbl[(p<<len)&((1<<HUFF64BITS)-1)];
+            }
+            while (count<3 && !(next&(HUFF64LONG|HUFF64CLUE)) && len+(int)(next>>8)<=HUFF64BITS);
+            t->multitbl[p].code[3] = 0;
+            t->multitbl[p].len = (unsigned char) len;
+            t->multitbl[p].count = (unsigned char) count;
+            if (count>1)
+                ++t->multicodes;
+        }
+
+        /* where most entries hold one code, as on data that hardly
+           packs, the single table is the faster */
+
+        t->multicodes = t->multicodes*2>=(1<<HUFF64BITS);
+    }
+
+    *ptype = type;
+    *pulen = ulen;
+    return(0);
+}
+
+/* one code, with the clue and what follows it, on the locals of the
+   caller, which goes to eof at the end of the stream.  A run repeats
+   the byte before it, prev at qdstart, where -1 rejects it. */
+
+#define HUFF64command(eof) \
+    HUFF64refill();                                     /* a long code takes 16 */\
+    entry = t->fasttbl[bitbuf>>(64-HUFF64BITS)];\
+    if (entry&HUFF64LONG)\
+    {\
+        cmp = (unsigned int) (bitbuf>>48);              /* 16 bit left justified compare */\
+\
+        numbits = 8;\
+        do\
+        {\
+            if (++numbits>mostbits)\
+                return(-1);\
+        }\
+        while (cmp>=t->cmptbl[numbits]);\
+\
+        cmp = (unsigned int) (bitbuf>>(64-numbits));\
+        bitbuf <<= numbits;\
+        bitcount -= numbits;\
+\
+        if (cmp-t->deltatbl[numbits]>=(unsigned int)numcodes)\
+            return(-1);\
+        code = t->codetbl[cmp-t->deltatbl[numbits]];    /* the code */\
+    }\
+    else\
+    {\
+        code = (unsigned char) entry;\
+        bitbuf <<= (entry>>8)&0x3f;\
+        bitcount -= (entry>>8)&0x3f;\
+    }\
+\
+    if (code!=clue)\
+    {\
+        if (qd>=qdend)\
+            return(-1);\
+        *qd++ = code;\
+    }\
+    else\
+    {\
+        HUFF64getnum(v);                                /* handle clue */\
+        runlen = (int) v;\
+        if (runlen)                                     /* runlength sequence */\
+        {\
+            if (runlen<0 || runlen>qdend-qd)\
+                return(-1);\
+            if (qd!=qdstart)\
+                memset(qd,qd[-1],runlen);\
+            else if (prev>=0)\
+                memset(qd,prev,runlen);\
+            else\
+                return(-1);\
+            qd += runlen;\
+        }\
+        else\
+        {\
+            HUFF64getbits(v,1);                         /* End Of File */\
+            if (v)\
+                goto eof;\
+\
+            HUFF64getbits(v,8);                         /* explicite byte */\
+            if (qd>=qdend)\
+                return(-1);\
+            *qd++ = (unsigned char) v;\
+        }\
+    }
+
+/* HUFF64command on a HuffBits64: returns 1, 0 at the end of the stream
+   or -1 */
+
+static int HUFF64_command(struct HuffBits64 *b, const struct HuffTables64 *t, unsigned char **pqd, unsigned char *qdstart, unsigned char *qdend, int prev)
+{
+    unsigned char   *qs;
+    unsigned char   *qsend;
+    unsigned long long bitbuf;
+    int             bitcount;
+    unsigned char   *qd = *pqd;
+    unsigned int    entry;
+    unsigned int    cmp;
+    unsigned int    v;
+    int             numbits;
+    int             runlen;
+    unsigned char   code;
+    unsigned char   clue = t->clue;
+    int             mostbits = t->mostbits;
+    int             numcodes = t->numcodes;
+
+    HUFF64load(b);
+    HUFF64command(eof);
+    HUFF64store(b);
+    *pqd = qd;
+    return(1);
+
+eof:
+    HUFF64store(b);
+    *pqd = qd;
+    return(0);
+}
+
+/* the codes of one stream into *pqd..qdend, up to its end: returns 0,
+   with *pqd the end of the output, or -1.  With a qdstop it returns 1
+   at the first code from qdstop on instead, if that is before the end
+   of the stream. */
+
+#define HUFF64one(bitbuf,bitcount,qd,onecode) \
+    entry = t->fasttbl[bitbuf>>(64-HUFF64BITS)];\
+    if (entry&(HUFF64LONG|HUFF64CLUE)) goto onecode;\
+    *qd++ = (unsigned char) entry;\
+    bitbuf <<= entry>>8;\
+    bitcount -= entry>>8;
+
+#define HUFF64multi(bitbuf,bitcount,qd,onecode) \
+    multi = &t->multitbl[bitbuf>>(64-HUFF64BITS)];\
+    if (!multi->count) goto onecode;\
+    memcpy(qd,multi->code,4);\
+    qd += multi->count;\
+    bitbuf <<= multi->len;\
+    bitcount -= multi->len;
+
+static int HUFF64_stream(struct HuffBits64 *b, const struct HuffTables64 *t, unsigned char **pqd, unsigned char *qdstart, unsigned char *qdstop, unsigned char *qdend, int prev)
+{
+    unsigned char   *qs;
+    unsigned char   *qsend;
+    unsigned long long bitbuf;
+    int             bitcount;
+    unsigned char   *qd = *pqd;
+    unsigned char   *qdfast = (qdstop && qdstop<qdend) ? qdstop : qdend;
+    unsigned int    entry;
+    const struct HuffMulti *multi;
+    int             multicodes = t->multicodes;
+    unsigned int    cmp;
+    unsigned int    v;
+    int             numbits;
+    int             runlen;
+    unsigned char   code;
+    unsigned char   clue = t->clue;
+    int             mostbits = t->mostbits;
+    int             numcodes = t->numcodes;
+
+    HUFF64load(b);
+    for (;;)
+    {
+        HUFF64refill();
+
+        /* 5 lookups of up to 11 bits fit in the 56 bits a refill leaves.
+           A multi lookup writes 4 bytes and keeps the ones it decoded */
+
+        if (multicodes && qdfast-qd>=5*4)
+        {
+            HUFF64multi(bitbuf,bitcount,qd,onecode);
+            HUFF64multi(bitbuf,bitcount,qd,onecode);
+            HUFF64multi(bitbuf,bitcount,qd,onecode);
+            HUFF64multi(bitbuf,bitcount,qd,onecode);
+            HUFF64multi(bitbuf,bitcount,qd,onecode);
+            continue;
+        }
+        if (!multicodes && qdfast-qd>=5)
+        {
+            HUFF64one(bitbuf,bitcount,qd,onecode);
+            HUFF64one(bitbuf,bitcount,qd,onecode);
+            HUFF64one(bitbuf,bitcount,qd,onecode);
+            HUFF64one(bitbuf,bitcount,qd,onecode);
+            HUFF64one(bitbuf,bitcount,qd,onecode);
+            continue;
+        }
+
+onecode:
+        if (qdstop && qd>=qdstop)
+        {
+            HUFF64store(b);
+            *pqd = qd;
+            return(1);
+        }
+        HUFF64command(eof);
+    }
+
+eof:
+    HUFF64store(b);
+    *pqd = qd;
+    return(0);
+}
+
+/* i and nextchar are the sums up to unpackbuf, 0 at the start */
+
+static void HUFF64_undelta(unsigned int type, unsigned char *unpackbuf, int ulen, unsigned int i, unsigned int nextchar)
+{
+    unsigned char   *qd;
+
+    if ((type&~0x0800)==0x32fb || (type&~0x0800)==0xb2fb)     /* deltaed? */
+    {
+        qd = unpackbuf;
+        while (qd<unpackbuf+ulen)
+        {
+            i += *qd;
+            *qd++ = (unsigned char) i;
+        }
+    }
+    else if ((type&~0x0800)==0x34fb || (type&~0x0800)==0xb4fb) /* accelerated? */
+    {
+        qd = unpackbuf;
+        while (qd<unpackbuf+ulen)
+        {
+            i += *qd;
+            nextchar += i;
+            *qd++ = (unsigned char) nextchar;
+        }
+    }
+}
+
+static int HUFF_decompress_64(unsigned char *packbuf, int packsize, unsigned char *unpackbuf, int unpackcap)
+{
+    struct HuffTables64 t;
+    struct HuffBits64 b;
+    unsigned int    type;
+    int             ulen;
+    unsigned char   *qd;
+
+    if (!packbuf || !unpackbuf || packsize<0)
+        return(0);
+    b.qs = packbuf;
+    b.qsend = packbuf+packsize;
+    b.bitbuf = 0;
+    b.bitcount = 0;
+
+    if (HUFF64_header(&b,&t,&type,&ulen)<0 || ulen<0 || ulen>unpackcap)
+        return(-1);
+    qd = unpackbuf;
+    if (HUFF64_stream(&b,&t,&qd,unpackbuf,0,unpackbuf+ulen,-1)<0 || qd!=unpackbuf+ulen)
+        return(-1);
+    if (HUFF64used(&b,packbuf)>packsize+HUFFSAFEREAD)
+        return(-1);
+
+    HUFF64_undelta(type,unpackbuf,ulen,0,0);
+    return(ulen);
+}
+
+/****************************************************************/
+/*  4 Stream Huffman Unpacker                                   */
+/****************************************************************/
+
+/* The 38fb 3afb 3cfb formats (b8fb bafb bcfb with 4 byte sizes) are
+   30fb 32fb 34fb split 4 ways.  After the code tables, padded to a byte,
+   come the packed sizes of 4 streams in the size field width, then the
+   streams.  Stream n holds bytes n*(ulen/4) on of the output, the last
+   the rest, each with its own runs and end of file code.  The streams
+   are decoded side by side, so the 4 lookups of each round do not wait
+   on each other, and one at a time once any is near its end. */
+
+#define HUFF4STREAMS    4
+#define HUFF4HEADMAX    4096        /* more than the longest tables */
+
+#define HUFF64spill(n) \
+    b[n].qs = qs##n; b[n].bitbuf = bitbuf##n; b[n].bitcount = bitcount##n; qd[n] = qd##n;
+
+#define HUFF64reload(n) \
+    qs##n = b[n].qs; bitbuf##n = b[n].bitbuf; bitcount##n = b[n].bitcount; qd##n = qd[n];
+
+#define HUFF64four(step) \
+    step(bitbuf0,bitcount0,qd0,onecode0);\
+    step(bitbuf1,bitcount1,qd1,onecode1);\
+    step(bitbuf2,bitcount2,qd2,onecode2);\
+    step(bitbuf3,bitcount3,qd3,onecode3);
+
+/* a long code or the clue in stream n: its command, and on with all 4
+   unless it has ended */
+
+#define HUFF64special(n) \
+    HUFF64spill(n);\
+    r = HUFF64_command(&b[n],t,&qd[n],qdstart[n],qdstart[n+1],-1);\
+    if (r<0)\
+        return(-1);\
+    HUFF64reload(n);\
+    if (!r)\
+    {\
+        done[n] = 1;\
+        break;\
+    }\
+    continue;
+
+static int HUFF_decompress_4(unsigned char *packbuf, int packsize, unsigned char *unpackbuf, int unpackcap, int *compressedsize)
+{
+    struct HuffTables64 tables;
+    struct HuffTables64 *t = &tables;
+    struct HuffBits64 b[HUFF4STREAMS];
+    unsigned char   *qsstart[HUFF4STREAMS];
+    unsigned char   *qdstart[HUFF4STREAMS+1];
+    unsigned char   *qd[HUFF4STREAMS];
+    int             done[HUFF4STREAMS];
+    unsigned int    type;
+    int             ulen;
+    int             sizebytes;
+    unsigned char   *sizes;
+    int             pos;
+    int             size;
+    int             i, j;
+
+    if (!packbuf || !unpackbuf)
+        return(0);
+
+    /* with no packsize, as from HUFF_decode, the sizes are trusted */
+
+    b[0].qs = packbuf;
+    b[0].qsend = packbuf+(packsize>=0 ? packsize : HUFF4HEADMAX);
+    b[0].bitbuf = 0;
+    b[0].bitcount = 0;
+
+    if (HUFF64_header(&b[0],t,&type,&ulen)<0 || ulen<0 || ulen>unpackcap)
+        return(-1);
+
+    /* stream sizes */
+
+    sizebytes = (type&0x8000) ? 4 : 3;
+    sizes = packbuf+HUFF64used(&b[0],packbuf);
+    pos = (int) (sizes-packbuf)+HUFF4STREAMS*sizebytes;
+    if (packsize>=0 && pos>packsize)
+        return(-1);
+    for (i=0; i<HUFF4STREAMS; ++i)
+    {
+        size = 0;
+        for (j=0; j<sizebytes; ++j)
+            size = (size<<8) | *sizes++;
+        if (size<0 || (packsize>=0 && size>packsize-pos))
+            return(-1);
+        qsstart[i] = packbuf+pos;
+        b[i].qs = packbuf+pos;
+        b[i].qsend = packbuf+pos+size;
+        b[i].bitbuf = 0;
+        b[i].bitcount = 0;
+        qdstart[i] = unpackbuf+i*(ulen/HUFF4STREAMS);
+        qd[i] = qdstart[i];
+        done[i] = 0;
+        pos += size;
+    }
+    qdstart[HUFF4STREAMS] = unpackbuf+ulen;
+
+/****************************************************************/
+/*  Main decoder                                                */
+/****************************************************************/
+
+    {
+        unsigned char   *qs0 = b[0].qs, *qs1 = b[1].qs, *qs2 = b[2].qs, *qs3 = b[3].qs;
+        unsigned char   *qsend0 = b[0].qsend, *qsend1 = b[1].qsend, *qsend2 = b[2].qsend, *qsend3 = b[3].qsend;
+        unsigned char   *qdend0 = qdstart[1], *qdend1 = qdstart[2], *qdend2 = qdstart[3], *qdend3 = qdstart[4];
+        int             multicodes = t->multicodes;
+        unsigned char   *qd0 = qd[0], *qd1 = qd[1], *qd2 = qd[2], *qd3 = qd[3];
+        unsigned long long bitbuf0 = 0, bitbuf1 = 0, bitbuf2 = 0, bitbuf3 = 0;
+        int             bitcount0 = 0, bitcount1 = 0, bitcount2 = 0, bitcount3 = 0;
+        unsigned int    entry;
+        const struct HuffMulti *multi;
+        int             r;
+
+        for (;;)
+        {
+            if (qdend0-qd0<5*4 || qdend1-qd1<5*4 || qdend2-qd2<5*4 || qdend3-qd3<5*4)
+                break;
+            HUFF64fill(qs0,qsend0,bitbuf0,bitcount0);
+            HUFF64fill(qs1,qsend1,bitbuf1,bitcount1);
+            HUFF64fill(qs2,qsend2,bitbuf2,bitcount2);
+            HUFF64fill(qs3,qsend3,bitbuf3,bitcount3);
+
+            if (multicodes)
+            {
+                HUFF64four(HUFF64multi);
+                HUFF64four(HUFF64multi);
+                HUFF64four(HUFF64multi);
+                HUFF64four(HUFF64multi);
+                HUFF64four(HUFF64multi);
+            }
+            else
+            {
+                HUFF64four(HUFF64one);
+                HUFF64four(HUFF64one);
+                HUFF64four(HUFF64one);
+                HUFF64four(HUFF64one);
+                HUFF64four(HUFF64one);
+            }
+            continue;
+
+onecode0:
+            HUFF64special(0);
+onecode1:
+            HUFF64special(1);
+onecode2:
+            HUFF64special(2);
+onecode3:
+            HUFF64special(3);
+        }
+        HUFF64spill(0); HUFF64spill(1); HUFF64spill(2); HUFF64spill(3);
+    }
+
+    /* the rest of each one at a time, each to end at the end of its
+       part and within its bytes */
+
+    for (i=0; i<HUFF4STREAMS; ++i)
+    {
+        if (!done[i] && HUFF64_stream(&b[i],t,&qd[i],qdstart[i],0,qdstart[i+1],-1)<0)
+            return(-1);
+        if (qd[i]!=qdstart[i+1])
+            return(-1);
+        if (HUFF64used(&b[i],qsstart[i])>(int) (b[i].qsend-qsstart[i])+HUFFSAFEREAD)
+            return(-1);
+    }
+
+    HUFF64_undelta(type,unpackbuf,ulen,0,0);
+    if (compressedsize)
+        *compressedsize = pos;
+    return(ulen);
+}
+
+/****************************************************************/
+/*  Sync Point Index                                            */
+/****************************************************************/
+
+/* The first decode of a 30fb 32fb or 34fb stream can note where the
+   codes stand every interval bytes of output, so the next decodes run
+   the parts between the points on several threads.  The index is
+
+       "HIDX"  packed size  unpacked size  count  data  sum   4 bytes each
+       count points of
+           packed byte     4 bytes, and bit in it (1)
+           output offset   4 bytes
+           prev            the byte before the offset, as packed
+           delta delta2    the undelta sums up to the offset
+
+   big endian, HUFFINDEXENTRY bytes a point.  data is HUFF_datasum of
+   the packed stream, so an index made of other data of the same sizes is
+   turned down before its prev and sums are trusted, and sum is FNV-1a
+   over the header fields and the points.  A point is the first code from a multiple of the interval on,
+   so no run spans it, and a run it starts with repeats prev.  Each part
+   decodes up to the next point, has to reach it at the bit noted, and
+   undeltas itself from its sums.  The 38fb types are already split and
+   get no points. */
+
+#define HUFFINDEXHEAD       24
+#define HUFFINDEXENTRY      12
+#define HUFFINDEXINTERVAL   65536
+
+struct HuffIndexJob
+{
+    const struct HuffTables64 *t;
+    unsigned char   *packbuf;
+    int             packsize;
+    unsigned char   *unpackbuf;
+    int             ulen;
+    unsigned int    type;
+    struct HuffBits64 start;    /* the bits of part 0 */
+    const unsigned char *index;
+    int             count;      /* parts, one more than the points */
+    std::atomic<int> next;
+    std::atomic<bool> failed;
+};
+
+/* a hash of the packed stream in 4 lanes of 8 bytes, a lot quicker
+   than FNV-1a a byte a step next to the decode */
+
+#define HUFFSUMSTEP(s,w)    { s = ((s)^(w))*1099511628211ull; s ^= (s)>>29; }
+
+static unsigned int HUFF_datasum(const unsigned char *packbuf, int packsize)
+{
+    unsigned long long sum[4];
+    unsigned long long w[4];
+    int i;
+
+    for (i=0; i<4; ++i)
+        sum[i] = 14695981039346656037ull+i;
+    for (i=0; i+32<=packsize; i+=32)
+    {
+        memcpy(w,packbuf+i,32);
+        HUFFSUMSTEP(sum[0],w[0]);
+        HUFFSUMSTEP(sum[1],w[1]);
+        HUFFSUMSTEP(sum[2],w[2]);
+        HUFFSUMSTEP(sum[3],w[3]);
+    }
+    for (; i<packsize; ++i)
+        HUFFSUMSTEP(sum[0],packbuf[i]);
+    HUFFSUMSTEP(sum[0],sum[1]);
+    HUFFSUMSTEP(sum[0],sum[2]);
+    HUFFSUMSTEP(sum[0],sum[3]);
+    return((unsigned int) (sum[0]^(sum[0]>>32)));
+}
+
+static unsigned int HUFF_indexsum(const unsigned char *index, int count)
+{
+    unsigned int sum = 2166136261u;
+    int i;
+
+    for (i=4; i<HUFFINDEXHEAD-4; ++i)
+        sum = (sum^index[i])*16777619u;
+    for (i=HUFFINDEXHEAD; i<HUFFINDEXHEAD+count*HUFFINDEXENTRY; ++i)
+        sum = (sum^index[i])*16777619u;
+    return(sum);
+}
+
+/* the bit position of point n, and its offset */
+
+static void HUFF_indexpoint(const unsigned char *index, int n, long long *bitpos, int *offset)
+{
+    const unsigned char *p = index+HUFFINDEXHEAD+n*HUFFINDEXENTRY;
+
+    *bitpos = (long long) ggetm(p,4)*8+p[4];
+    *offset = (int) ggetm(p+5,4);
+}
+
+static int HUFF_indexpart(struct HuffIndexJob *job, int n)
+{
+    const unsigned char *p;
+    struct HuffBits64 b;
+    unsigned char   *qd;
+    unsigned char   *qdstart;
+    unsigned char   *qdend;
+    long long       bitpos;
+    long long       endpos;
+    int             offset;
+    int             endoffset;
+    int             prev;
+    int             skip;
+    int             r;
+
+    if (n)
+    {
+        p = job->index+HUFFINDEXHEAD+(n-1)*HUFFINDEXENTRY;
+        HUFF_indexpoint(job->index,n-1,&bitpos,&offset);
+        b.qs = job->packbuf+(bitpos>>3);
+        b.qsend = job->packbuf+job->packsize;
+        b.bitbuf = 0;
+        b.bitcount = 0;
+        skip = (int) (bitpos&7);
+        if (skip)
+        {
+            HUFF64fill(b.qs,b.qsend,b.bitbuf,b.bitcount);
+            b.bitbuf <<= skip;
+            b.bitcount -= skip;
+        }
+        prev = p[9];
+    }
+    else
+    {
+        b = job->start;
+        offset = 0;
+        prev = -1;
+    }
+
+    qdstart = job->unpackbuf+offset;
+    qd = qdstart;
+    if (n<job->count-1)
+    {
+        HUFF_indexpoint(job->index,n,&endpos,&endoffset);
+        qdend = job->unpackbuf+endoffset;
+        r = HUFF64_stream(&b,job->t,&qd,qdstart,qdend,qdend,prev);
+        if (r!=1 || qd!=qdend || (long long) (b.qs-job->packbuf)*8-b.bitcount!=endpos)
+            return(-1);
+    }
+    else
+    {
+        qdend = job->unpackbuf+job->ulen;
+        r = HUFF64_stream(&b,job->t,&qd,qdstart,0,qdend,prev);
+        if (r!=0 || qd!=qdend || HUFF64used(&b,job->packbuf)>job->packsize+HUFFSAFEREAD)
+            return(-1);
+    }
+
+    if (n)
+        HUFF64_undelta(job->type,qdstart,(int) (qdend-qdstart),p[10],p[11]);
+    else
+        HUFF64_undelta(job->type,qdstart,(int) (qdend-qdstart),0,0);
+    return(0);
+}
+
+static void HUFF_indexworker(struct HuffIndexJob *job)
+{
+    int i;
+
+    while (!job->failed && (i = job->next++) < job->count)
+        if (HUFF_indexpart(job,i)<0)
+            job->failed = true;
+}
+
+/* as HUFF_decompress_64, noting a point every interval bytes in index,
+   which has room for HUFF_index_size */
+
+static int HUFF_decompress_index(unsigned char *packbuf, int packsize, unsigned char *unpackbuf, int unpackcap, unsigned char *index, int *indexsize, int interval)
+{
+    struct HuffTables64 t;
+    struct HuffBits64 b;
+    unsigned int    type;
+    int             ulen;
+    unsigned char   *qd;
+    unsigned char   *p;
+    long long       bitpos;
+    int             count;
+    int             offset;
+    int             r;
+    int             i;
+
+    if (!packbuf || !unpackbuf || !index || packsize<0)
+        return(0);
+    if (interval<=0)
+        interval = HUFFINDEXINTERVAL;
+
+    count = 0;
+    if (packsize>=2 && ggetm(packbuf,2)&0x0800)
+    {
+        ulen = HUFF_decompress_4(packbuf,packsize,unpackbuf,unpackcap,0);
+        if (ulen<0)
+            return(-1);
+    }
+    else
+    {
+        b.qs = packbuf;
+        b.qsend = packbuf+packsize;
+        b.bitbuf = 0;
+        b.bitcount = 0;
+        if (HUFF64_header(&b,&t,&type,&ulen)<0 || ulen<0 || ulen>unpackcap)
+            return(-1);
+
+        qd = unpackbuf;
+        for (;;)
+        {
+            offset = (int) (qd-unpackbuf);
+            offset = offset-offset%interval+interval;
+            r = HUFF64_stream(&b,&t,&qd,unpackbuf,offset<ulen ? unpackbuf+offset : 0,unpackbuf+ulen,-1);
+            if (r<0)
+                return(-1);
+            if (!r)
+                break;
+
+            bitpos = (long long) (b.qs-packbuf)*8-b.bitcount;
+            p = index+HUFFINDEXHEAD+count*HUFFINDEXENTRY;
+            gputm(p,(unsigned int) (bitpos>>3),4);
+            p[4] = (unsigned char) (bitpos&7);
+            gputm(p+5,(unsigned int) (qd-unpackbuf),4);
+            p[9] = qd[-1];
+            ++count;
+        }
+        if (qd!=unpackbuf+ulen || HUFF64used(&b,packbuf)>packsize+HUFFSAFEREAD)
+            return(-1);
+        HUFF64_undelta(type,unpackbuf,ulen,0,0);
+
+        /* the sums up to each point are the bytes before it: the output
+           of 32fb, and of 34fb with the step between them */
+
+        for (i=0; i<count; ++i)
+        {
+            p = index+HUFFINDEXHEAD+i*HUFFINDEXENTRY;
+            offset = (int) ggetm(p+5,4);
+            p[10] = p[11] = 0;
+            if ((type&~0x8000)==0x32fb)
+                p[10] = unpackbuf[offset-1];
+            else if ((type&~0x8000)==0x34fb)
+            {
+                p[10] = (unsigned char) (unpackbuf[offset-1]-(offset>1 ? unpackbuf[offset-2] : 0));
+                p[11] = unpackbuf[offset-1];
+            }
+        }
+    }
+
+    memcpy(index,"HIDX",4);
+    gputm(index+4,(unsigned int) packsize,4);
+    gputm(index+8,(unsigned int) ulen,4);
+    gputm(index+12,(unsigned int) count,4);
+    gputm(index+16,HUFF_datasum(packbuf,packsize),4);
+    gputm(index+20,HUFF_indexsum(index,count),4);
+    *indexsize = HUFFINDEXHEAD+count*HUFFINDEXENTRY;
+    return(ulen);
+}
+
+/* the parts of the stream on threads, 0 for one per core */
+
+static int HUFF_decompress_mt(unsigned char *packbuf, int packsize, unsigned char *unpackbuf, int unpackcap, const unsigned char *index, int indexsize, int threads)
+{
+    struct HuffTables64 t;
+    struct HuffIndexJob job;
+    std::thread     *workers;
+    long long       bitpos;
+    long long       lastpos;
+    int             offset;
+    int             lastoffset;
+    int             count;
+    int             ulen;
+    int             i;
+
+    if (!packbuf || !unpackbuf || !index || packsize<0)
+        return(0);
+    if (indexsize<HUFFINDEXHEAD || memcmp(index,"HIDX",4)
+     || (int) ggetm(index+4,4)!=packsize)
+        return(-1);
+    count = (int) ggetm(index+12,4);
+    if (count<0 || count>(indexsize-HUFFINDEXHEAD)/HUFFINDEXENTRY
+     || ggetm(index+20,4)!=HUFF_indexsum(index,count)
+     || ggetm(index+16,4)!=HUFF_datasum(packbuf,packsize))
+        return(-1);
+    if (!count || (packsize>=2 && ggetm(packbuf,2)&0x0800))
+        return(HUFF_decode_fast(unpackbuf,unpackcap,packbuf,packsize));
+
+    job.start.qs = packbuf;
+    job.start.qsend = packbuf+packsize;
+    job.start.bitbuf = 0;
+    job.start.bitcount = 0;
+    if (HUFF64_header(&job.start,&t,&job.type,&ulen)<0 || ulen<0 || ulen>unpackcap
+     || (int) ggetm(index+8,4)!=ulen)
+        return(-1);
+
+    /* points in order, within the stream and the output */
+
+    lastpos = (long long) (job.start.qs-packbuf)*8-job.start.bitcount;
+    lastoffset = 0;
+    for (i=0; i<count; ++i)
+    {
+        HUFF_indexpoint(index,i,&bitpos,&offset);
+        if (bitpos<=lastpos || bitpos>(long long) packsize*8 || offset<=lastoffset || offset>=ulen)
+            return(-1);
+        lastpos = bitpos;
+        lastoffset = offset;
+    }
+
+    job.t = &t;
+    job.packbuf = packbuf;
+    job.packsize = packsize;
+    job.unpackbuf = unpackbuf;
+    job.ulen = ulen;
+    job.index = index;
+    job.count = count+1;
+    job.next = 0;
+    job.failed = false;
+
+    if (threads<=0)
+        threads = (int) std::thread::hardware_concurrency();
+    threads = qmin(qmax(threads,1),job.count);
+    workers = new std::thread[threads-1];
+    for (i=0; i<threads-1; ++i)
+        workers[i] = std::thread(HUFF_indexworker,&job);
+    HUFF_indexworker(&job);
+    for (i=0; i<threads-1; ++i)
+        workers[i].join();
+    delete[] workers;
+
+    return(job.failed ? -1 : ulen);
+}
+
 #if defined(_MSC_VER)
 #pragma warning(pop)
 #endif
@@ -514,7 +2096,7 @@ nextloop:
 /****************************************************************/
 
 /* check for reasonable header: */
-/* 30fb..35fb header */
+/* 30fb..35fb 38fb 3afb 3cfb header */
 
 bool GCALL HUFF_is(const void *compresseddata)
 {
@@ -532,7 +2114,13 @@ bool GCALL HUFF_is(const void *compresseddata)
      || packtype==0xb2fb
      || packtype==0xb3fb
      || packtype==0xb4fb
-     || packtype==0xb5fb)
+     || packtype==0xb5fb
+     || packtype==0x38fb
+     || packtype==0x3afb
+     || packtype==0x3cfb
+     || packtype==0xb8fb
+     || packtype==0xbafb
+     || packtype==0xbcfb)
         ok = true;
 
     return(ok);
@@ -553,7 +2141,7 @@ int GCALL HUFF_size(const void *compresseddata)
     {
         len = ggetm((char *)compresseddata+2+ssize,ssize);
     }
-    else                    /* 30fb 32fb 34fb */
+    else                    /* 30fb 32fb 34fb 38fb 3afb 3cfb */
     {
         len = ggetm((char *)compresseddata+2,ssize);
     }
@@ -563,8 +2151,53 @@ int GCALL HUFF_size(const void *compresseddata)
 
 int GCALL HUFF_decode(void *dest, const void *compresseddata, int *compressedsize)
 {
+    if (ggetm(compresseddata,2)&0x0800)     /* 38fb 3afb 3cfb */
+        return(HUFF_decompress_4((unsigned char *)compresseddata, -1, (unsigned char *)dest, HUFF_size(compresseddata), compressedsize));
     return(HUFF_decompress((unsigned char *)compresseddata, (unsigned char *)dest));
 }
 
+/* returns the unpacked size, or -1 if the data is truncated or corrupt
+   or does not fit in destcap bytes */
+
+int GCALL HUFF_decode_safe(void *dest, int destcap, const void *compresseddata, int compressedsize)
+{
+    if (compressedsize>=2 && ggetm(compresseddata,2)&0x0800)
+        return(HUFF_decompress_4((unsigned char *)compresseddata, compressedsize, (unsigned char *)dest, destcap, 0));
+    return(HUFF_decompress_safe((unsigned char *)compresseddata, compressedsize, (unsigned char *)dest, destcap));
+}
+
+/* as HUFF_decode_safe, with the same output, on a 64 bit bit reader */
+
+int GCALL HUFF_decode_fast(void *dest, int destcap, const void *compresseddata, int compressedsize)
+{
+    if (compressedsize>=2 && ggetm(compresseddata,2)&0x0800)
+        return(HUFF_decompress_4((unsigned char *)compresseddata, compressedsize, (unsigned char *)dest, destcap, 0));
+    return(HUFF_decompress_64((unsigned char *)compresseddata, compressedsize, (unsigned char *)dest, destcap));
+}
+
+/* as HUFF_decode_fast, and notes the sync points of the stream every
+   interval bytes (0 for 64 KB) of output in index, which needs room for
+   HUFF_index_size bytes.  *indexsize is the bytes of index used. */
+
+int GCALL HUFF_decode_index(void *dest, int destcap, const void *compresseddata, int compressedsize, void *index, int *indexsize, int interval)
+{
+    return(HUFF_decompress_index((unsigned char *)compresseddata, compressedsize, (unsigned char *)dest, destcap, (unsigned char *)index, indexsize, interval));
+}
+
+/* as HUFF_decode_fast, on threads (0 for one per core) with the index
+   HUFF_decode_index made of the same data */
+
+int GCALL HUFF_decode_mt(void *dest, int destcap, const void *compresseddata, int compressedsize, const void *index, int indexsize, int threads)
+{
+    return(HUFF_decompress_mt((unsigned char *)compresseddata, compressedsize, (unsigned char *)dest, destcap, (const unsigned char *)index, indexsize, threads));
+}
+
+int GCALL HUFF_index_size(int unpackedsize, int interval)
+{
+    if (interval<=0)
+        interval = HUFFINDEXINTERVAL;
+    return(HUFFINDEXHEAD+qmax(unpackedsize,0)/interval*HUFFINDEXENTRY);
+}
+
 #endif
 
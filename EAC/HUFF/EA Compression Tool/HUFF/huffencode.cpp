@@ -30,6 +30,8 @@
 #define __HUFWRITE 1
 
 #include <string.h>
+#include <atomic>
+#include <thread>
 #include "codex.h"
 #include "huffcodex.h"
 
@@ -48,6 +50,7 @@ struct HUFFMemStruct
 #define HUFFCODES					256
 #define HUFFMAXBITS					16
 #define HUFFREPTBL					252
+#define HUFFMTCHUNK					(256*1024)
 
 struct HuffEncodeContext
 {
@@ -857,107 +860,26 @@ static void HUFF_analysis(struct HuffEncodeContext *EC,
 }
 
 
-static void HUFF_pack(struct HuffEncodeContext *EC,
+/* the codes of start..end, i1 is the byte before start or 256 at the
+   start of a stream */
+
+static void HUFF_packcodes(struct HuffEncodeContext *EC,
                struct HUFFMemStruct *dest,
-               unsigned int	opt)
+               unsigned char	*start,
+               unsigned char	*end,
+               unsigned int	i1,
+               unsigned int	rladjust)
 {
 	unsigned char			*bptr1;
 	unsigned char			*bptr2;
 	unsigned int			i;
-	unsigned int			i1;
 	unsigned int			i2;
 	unsigned int			i3;
-	int						uptype;
-	unsigned int			hlen, ibits, rladjust;
-	int						di, firstcode, firstbits;
+	int						di;
 	unsigned int			rep1, repn, ncode, irep, remaining,curpc;
 
-/* write header */
-
 	curpc = 0L;
 
-	uptype = 38;
-	rladjust = 1;
-	if (uptype==38)
-	{
-		if (uptype==34)
-		{
-			HUFF_writenum(EC,dest,(unsigned int) EC->ulen);
-
-			ibits = 0;
-			if ((opt & 16) && (!EC->chainused))
-				ibits = 1;
-
-			i = 0;									/* write options field */
-			if (EC->clues)
-				i = 1;
-			if (ibits)
-				i += 2;
-			if (EC->dclues)
-				i += 4;
-			HUFF_writenum(EC,dest,(unsigned int) i);
-
-			if (EC->clues)
-			{	HUFF_writenum(EC,dest,(unsigned int) EC->clue);
-				HUFF_writenum(EC,dest,(unsigned int) EC->clues);
-			}
-			if (EC->dclues)
-			{	HUFF_writenum(EC,dest,(unsigned int) EC->dclue);
-				HUFF_writenum(EC,dest,(unsigned int) EC->dclues);
-			}
-
-			if (!ibits)
-				HUFF_writenum(EC,dest,(unsigned int) EC->mostbits);
-		}
-		else
-		{
-			HUFF_writebits(EC,dest,(unsigned int) EC->clue, 8);	/* clue */
-			rladjust = 0;
-		}
-
-		for (i=1; i <= EC->mostbits; ++i)
-			HUFF_writenum(EC,dest,(unsigned int) EC->bitnum[i]);
-
-		for (i=0; i<HUFFCODES; ++i)
-			EC->qleapcode[i] = 0;
-
-		i = 0;
-		i2 = 255;
-		firstbits = 0;
-		firstcode = -1;
-		while (i<EC->codes)
-		{
-			i1 = EC->sortptr[i];
-#if 0
-			if (EC->bitsarray[i1]!=firstbits)
-			{
-				i2 = firstcode;
-				firstcode = i1;
-				firstbits = EC->bitsarray[i2];
-			}
-#endif
-
-/* calculate leapfrog delta */
-
-			di = -1;
-			do
-			{
-				i2 = (i2+1)&255;
-				if (!EC->qleapcode[i2])
-					++di;
-			} while (i1!=i2);
-			EC->qleapcode[i2] = 1;
-			HUFF_writenum(EC,dest,(unsigned int) di);
-			++i;
-		}
-	}
-	hlen = EC->plen+1;
-
-	if (!EC->clues)
-		EC->clue = HUFFBIGNUM;
-
-/* write packed file */
-
 /* registers vars usage
     i  - current byte
     i1 - previous byte
@@ -966,17 +888,16 @@ static void HUFF_pack(struct HuffEncodeContext *EC,
 */
 
 	i = 1;
-	i1 = 256;
-	bptr1 = EC->buffer;
-	while (bptr1<EC->bufptr)
+	bptr1 = start;
+	while (bptr1<end)
 	{	i = (unsigned int) *bptr1++;
 
 		if (i == i1)
 		{
 			i2 = 0;
 			bptr2 = bptr1+30000;
-			if (bptr2>(EC->bufptr))
-				bptr2 = EC->bufptr;
+			if (bptr2>end)
+				bptr2 = end;
 
 			while ((i == i1) && (bptr1 < bptr2))
 			{	i = (unsigned int) *bptr1++;
@@ -1058,10 +979,14 @@ static void HUFF_pack(struct HuffEncodeContext *EC,
 		if (!i3)
 			HUFF_writecode(EC,dest,i);
 
-		if (((int) bptr1- (int) EC->buffer) >= (int)(EC->plen+curpc))
-			curpc = (int) bptr1 - (int) EC->buffer - EC->plen;
+		if (((int) bptr1- (int) start) >= (int)(EC->plen+curpc))
+			curpc = (int) bptr1 - (int) start - EC->plen;
 	}
+}
 
+static void HUFF_packeof(struct HuffEncodeContext *EC,
+               struct HUFFMemStruct *dest)
+{
 	/* write EOF ([clue] 0gn [10]) */
 
 	HUFF_writebits(EC,dest,EC->patternarray[EC->clue], EC->bitsarray[EC->clue]);
@@ -1071,15 +996,401 @@ static void HUFF_pack(struct HuffEncodeContext *EC,
 	/* flush bits */
 
 	HUFF_writebits(EC,dest,(unsigned int) 0,7);
+}
+
+/* the codes of start..end, then EOF and the flush */
+
+static void HUFF_packdata(struct HuffEncodeContext *EC,
+               struct HUFFMemStruct *dest,
+               unsigned char	*start,
+               unsigned char	*end,
+               unsigned int	rladjust)
+{
+	HUFF_packcodes(EC,dest,start,end,256,rladjust);
+	HUFF_packeof(EC,dest);
+}
+
+/* Multithreaded Pack
+
+   The codes are fixed once the tree is built, so start..end is cut in
+   chunks of about HUFFMTCHUNK that threads pack on their own copy of the
+   context, each in its own buffer.  A chunk may only start where the
+   serial loop starts a command: one byte past a byte that differs from
+   the byte before it, since a run or a single code always ends there.
+   Then i1 is the byte before the chunk and the chunk packs to the same
+   bits.  The bit offset of each chunk is the sum of the lengths before
+   it; the threads copy the whole bytes of their chunk to that offset
+   and the bytes shared by two chunks are put together after. */
+
+struct HuffChunk
+{
+	unsigned char	*start;
+	unsigned char	*end;
+	unsigned char	*out;
+	size_t			bits;
+	size_t			offset;
+};
 
-	curpc += 2;
+struct HuffPackJob
+{
+	struct HuffEncodeContext	*EC;
+	struct HuffChunk			*chunks;
+	unsigned char				*dest;
+	unsigned int				rladjust;
+	int							count;
+	int							stitch;
+	std::atomic<int>			next;
+};
+
+/* n bits, at most 8, from bit pos of a chunk buffer */
+
+static unsigned int HUFF_peekbits(const unsigned char *buf,
+               size_t	pos,
+               unsigned int	n)
+{
+	unsigned int w;
+
+	buf += pos>>3;
+	w = ((unsigned int) buf[0]<<8) | buf[1];
+	return((w >> (16-(pos&7)-n)) & ((1u<<n)-1));
+}
+
+/* bits of the chunk past its first partial byte, up to its last one */
+
+static void HUFF_copychunk(unsigned char *dest,
+               struct HuffChunk *c)
+{
+	unsigned char	*d;
+	unsigned char	*s;
+	unsigned int	h;
+	size_t			m;
+	size_t			i;
+
+	h = (unsigned int) ((8-(c->offset&7))&7);
+	if (h>c->bits)
+		h = (unsigned int) c->bits;
+	m = (c->bits-h)>>3;
+	d = dest+((c->offset+h)>>3);
+	s = c->out;
+	if (!h)
+		memcpy(d,s,m);
+	else
+		for (i=0; i<m; ++i)
+			d[i] = (unsigned char) ((s[i]<<h) | (s[i+1]>>(8-h)));
+}
+
+static void HUFF_packworker(struct HuffPackJob *job)
+{
+	struct HuffEncodeContext	ec;
+	struct HUFFMemStruct		out;
+	struct HuffChunk			*c;
+	int							i;
+
+	if (job->stitch)
+	{
+		while ((i = job->next++) < job->count)
+			HUFF_copychunk(job->dest,&job->chunks[i]);
+		return;
+	}
+
+	ec = *job->EC;
+	while ((i = job->next++) < job->count)
+	{
+		c = &job->chunks[i];
+		ec.packbits = 0;
+		ec.workpattern = 0L;
+		ec.plen = 0;
+		out.ptr = (char *) c->out;
+		out.len = 0;
+		HUFF_packcodes(&ec,&out,c->start,c->end,(c->start==job->chunks[0].start) ? 256 : c->start[-1],job->rladjust);
+		if (i==job->count-1)
+			HUFF_packeof(&ec,&out);
+		c->out[out.len] = (unsigned char) (ec.workpattern>>16);
+		c->out[out.len+1] = 0;
+		c->bits = (size_t) out.len*8+ec.packbits;
+	}
+}
+
+static void HUFF_packrun(struct HuffPackJob *job,
+               int	threads)
+{
+	std::thread	*workers;
+	int			i;
+
+	job->next = 0;
+	workers = new std::thread[threads-1];
+	for (i=0; i<threads-1; ++i)
+		workers[i] = std::thread(HUFF_packworker,job);
+	HUFF_packworker(job);
+	for (i=0; i<threads-1; ++i)
+		workers[i].join();
+	delete[] workers;
+}
+
+/* as HUFF_packdata, over threads (0 for one per core) */
+
+static void HUFF_packmt(struct HuffEncodeContext *EC,
+               struct HUFFMemStruct *dest,
+               unsigned char	*start,
+               unsigned char	*end,
+               unsigned int	rladjust,
+               int	threads)
+{
+	struct HuffPackJob	job;
+	struct HuffChunk	*c;
+	unsigned char		*d;
+	unsigned char		*q;
+	unsigned char		*out;
+	size_t				pos;
+	size_t				total;
+	unsigned int		h;
+	unsigned int		t;
+	int					n;
+	int					i;
+
+	n = (int) ((end-start)/HUFFMTCHUNK)+1;
+	job.chunks = 0;
+	out = 0;
+	if (n>1)
+	{
+		job.chunks = (struct HuffChunk *) galloc(n*sizeof(struct HuffChunk));
+		out = (unsigned char *) galloc((size_t) (end-start)*2+n*16);
+	}
+	if (!job.chunks || !out)
+	{
+		if (out) gfree(out);
+		if (job.chunks) gfree(job.chunks);
+		HUFF_packdata(EC,dest,start,end,rladjust);
+		return;
+	}
+
+	/* cut the chunks where a command starts */
+
+	job.count = 0;
+	q = start;
+	while (q<end)
+	{
+		c = &job.chunks[job.count++];
+		c->start = q;
+		c->out = out;
+		if (end-q<=HUFFMTCHUNK || job.count==n)
+			q = end;
+		else
+		{
+			q += HUFFMTCHUNK;
+			while (q<end && q[-1]==q[-2])
+				++q;
+		}
+		c->end = q;
+		out += (c->end-c->start)*2+16;
+	}
+
+	if (threads<=0)
+		threads = (int) std::thread::hardware_concurrency();
+	threads = qmin(qmax(threads,1),job.count);
+
+	job.EC = EC;
+	job.dest = (unsigned char *) dest->ptr;
+	job.rladjust = rladjust;
+	job.stitch = 0;
+	HUFF_packrun(&job,threads);
+
+	/* prefix sum of the chunk lengths, after the bits already written */
+
+	d = job.dest;
+	pos = (size_t) dest->len*8+EC->packbits;
+	if (EC->packbits)
+		d[dest->len] = (unsigned char) (EC->workpattern>>16);
+	for (i=0; i<job.count; ++i)
+	{
+		job.chunks[i].offset = pos;
+		pos += job.chunks[i].bits;
+	}
+	total = pos;
+
+	job.stitch = 1;
+	HUFF_packrun(&job,threads);
+
+	/* the partial bytes at both ends of each chunk, in order: the first
+	   goes in after the bits of the chunks before, the last starts a
+	   byte, but past the end only flush bits are left */
+
+	for (i=0; i<job.count; ++i)
+	{
+		c = &job.chunks[i];
+		h = (unsigned int) ((8-(c->offset&7))&7);
+		if (h>c->bits)
+			h = (unsigned int) c->bits;
+		if (h && (c->offset>>3)<(total>>3))
+			d[c->offset>>3] |= (unsigned char) (HUFF_peekbits(c->out,0,h) << (8-(c->offset&7)-h));
+		t = (unsigned int) ((c->bits-h)&7);
+		pos = c->offset+c->bits-t;
+		if (t && (pos>>3)<(total>>3))
+			d[pos>>3] = (unsigned char) (HUFF_peekbits(c->out,c->bits-t,t) << (8-t));
+	}
+
+	EC->plen += (unsigned int) ((total>>3)-dest->len);
+	dest->len = (int) (total>>3);
+	EC->packbits = (unsigned int) (total&7);
+	EC->workpattern = 0L;
+
+	gfree(job.chunks[0].out);
+	gfree(job.chunks);
+}
+
+/* streams is 1, or 4 for the 38fb types: the tables are flushed to a
+   byte and followed by the packed size of each stream in sizebytes,
+   then the streams, each of its part of the buffer */
+
+static void HUFF_pack(struct HuffEncodeContext *EC,
+               struct HUFFMemStruct *dest,
+               unsigned int	opt,
+               int	streams,
+               int	sizebytes,
+               int	threads)
+{
+	unsigned int			i;
+	unsigned int			i1;
+	unsigned int			i2;
+	int						uptype;
+	unsigned int			hlen, ibits, rladjust;
+	int						di, firstcode, firstbits;
+
+/* write header */
+
+	uptype = 38;
+	rladjust = 1;
+	if (uptype==38)
+	{
+		if (uptype==34)
+		{
+			HUFF_writenum(EC,dest,(unsigned int) EC->ulen);
+
+			ibits = 0;
+			if ((opt & 16) && (!EC->chainused))
+				ibits = 1;
+
+			i = 0;									/* write options field */
+			if (EC->clues)
+				i = 1;
+			if (ibits)
+				i += 2;
+			if (EC->dclues)
+				i += 4;
+			HUFF_writenum(EC,dest,(unsigned int) i);
+
+			if (EC->clues)
+			{	HUFF_writenum(EC,dest,(unsigned int) EC->clue);
+				HUFF_writenum(EC,dest,(unsigned int) EC->clues);
+			}
+			if (EC->dclues)
+			{	HUFF_writenum(EC,dest,(unsigned int) EC->dclue);
+				HUFF_writenum(EC,dest,(unsigned int) EC->dclues);
+			}
+
+			if (!ibits)
+				HUFF_writenum(EC,dest,(unsigned int) EC->mostbits);
+		}
+		else
+		{
+			HUFF_writebits(EC,dest,(unsigned int) EC->clue, 8);	/* clue */
+			rladjust = 0;
+		}
+
+		for (i=1; i <= EC->mostbits; ++i)
+			HUFF_writenum(EC,dest,(unsigned int) EC->bitnum[i]);
+
+		for (i=0; i<HUFFCODES; ++i)
+			EC->qleapcode[i] = 0;
+
+		i = 0;
+		i2 = 255;
+		firstbits = 0;
+		firstcode = -1;
+		while (i<EC->codes)
+		{
+			i1 = EC->sortptr[i];
+#if 0
+			if (EC->bitsarray[i1]!=firstbits)
+			{
+				i2 = firstcode;
+				firstcode = i1;
+				firstbits = EC->bitsarray[i2];
+			}
+#endif
+
+/* calculate leapfrog delta */
+
+			di = -1;
+			do
+			{
+				i2 = (i2+1)&255;
+				if (!EC->qleapcode[i2])
+					++di;
+			} while (i1!=i2);
+			EC->qleapcode[i2] = 1;
+			HUFF_writenum(EC,dest,(unsigned int) di);
+			++i;
+		}
+	}
+	hlen = EC->plen+1;
+
+	if (!EC->clues)
+		EC->clue = HUFFBIGNUM;
+
+/* write packed file */
+
+	if (streams<=1)
+	{
+		if (threads==1)
+			HUFF_packdata(EC,dest,EC->buffer,EC->bufptr,rladjust);
+		else
+			HUFF_packmt(EC,dest,EC->buffer,EC->bufptr,rladjust,threads);
+	}
+	else
+	{
+		unsigned char	*start;
+		unsigned char	*end;
+		unsigned int	seg;
+		int				sizes;
+		int				size;
+		int				s;
+		int				b;
+
+		HUFF_writebits(EC,dest,(unsigned int) 0,7);			/* flush the tables */
+		EC->packbits = 0;
+		EC->workpattern = 0L;
+
+		sizes = dest->len;
+		dest->len += streams*sizebytes;
+		EC->plen += streams*sizebytes;
+
+		seg = EC->ulen/streams;
+		for (s=0; s<streams; ++s)
+		{
+			start = EC->buffer+s*seg;
+			end = (s==streams-1) ? EC->bufptr : start+seg;
+			size = dest->len;
+			if (threads==1)
+				HUFF_packdata(EC,dest,start,end,rladjust);
+			else
+				HUFF_packmt(EC,dest,start,end,rladjust,threads);
+			EC->packbits = 0;
+			EC->workpattern = 0L;
+			size = dest->len-size;
+			for (b=0; b<sizebytes; ++b)
+				*(dest->ptr+sizes+s*sizebytes+b) = (char) (size>>((sizebytes-1-b)*8));
+		}
+	}
 }
 
 static int HUFF_packfile(struct HuffEncodeContext *EC,
                    struct HUFFMemStruct	*infile,
                    struct HUFFMemStruct	*outfile,
                    int	ulen,
-                   int	deltaed)
+                   int	deltaed,
+                   int	streams,
+                   int	threads)
 {
 	unsigned int i;
 	unsigned int uptype=0;
@@ -1122,6 +1433,26 @@ static int HUFF_packfile(struct HuffEncodeContext *EC,
 
 /* write standard header stuff (type/signature/ulen/adjust) */
 
+    if (streams>1)      // 38fb split header
+    {
+    	if (deltaed==0) 		uptype = 0x38fb;
+    	else if (deltaed==1)	uptype = 0x3afb;
+    	else if (deltaed==2)	uptype = 0x3cfb;
+    	if (ulen>0xffffff)
+    	{
+    		HUFF_writebits(EC,outfile,(unsigned int) uptype|0x8000, 16);
+    		HUFF_writebits(EC,outfile,(unsigned int) ulen, 32);
+    		HUFF_pack(EC,outfile, opt, streams, 4, threads);
+    	}
+    	else
+    	{
+    		HUFF_writebits(EC,outfile,(unsigned int) uptype, 16);
+    		HUFF_writebits(EC,outfile,(unsigned int) ulen, 24);
+    		HUFF_pack(EC,outfile, opt, streams, 3, threads);
+    	}
+    	return(outfile->len);
+    }
+
     if (ulen>0xffffff)  // 32 bit header required
     {
     	/* simple fb6 header */
@@ -1174,7 +1505,7 @@ static int HUFF_packfile(struct HuffEncodeContext *EC,
     	}
     }
 
-	HUFF_pack(EC,outfile, opt);
+	HUFF_pack(EC,outfile, opt, 1, 0, threads);
 
     return(outfile->len);
 }
@@ -1184,7 +1515,9 @@ static int HUFF_packfile(struct HuffEncodeContext *EC,
 /*  Encode Function                                             */
 /****************************************************************/
 
-int GCALL HUFF_encode(void *compresseddata, const void *source, int sourcesize, int *opts)
+/* threads is 1 for the serial pack */
+
+static int HUFF_encodewith(void *compresseddata, const void *source, int sourcesize, int *opts, int threads)
 {
     int   plen=0;
     struct HUFFMemStruct infile;
@@ -1198,7 +1531,7 @@ int GCALL HUFF_encode(void *compresseddata, const void *source, int sourcesize,
     EC = (struct HuffEncodeContext *)galloc(sizeof(struct HuffEncodeContext));
     if (EC)
     {
-        switch (opt)
+        switch (opt&0xff)
         {
             default:
             case 0:
@@ -1223,7 +1556,7 @@ int GCALL HUFF_encode(void *compresseddata, const void *source, int sourcesize,
         outfile.ptr = (char *)compresseddata;
         outfile.len = sourcesize;
 
-        plen = HUFF_packfile(EC,&infile, &outfile, sourcesize, opt);
+        plen = HUFF_packfile(EC,&infile, &outfile, sourcesize, opt&0xff, (opt&HUFF_OPT_4STREAMS) ? 4 : 1, threads);
 
         if (deltabuf) gfree(deltabuf);
         gfree(EC);
@@ -1231,4 +1564,17 @@ int GCALL HUFF_encode(void *compresseddata, const void *source, int sourcesize,
     return(plen);
 }
 
+int GCALL HUFF_encode(void *compresseddata, const void *source, int sourcesize, int *opts)
+{
+    return(HUFF_encodewith(compresseddata,source,sourcesize,opts,1));
+}
+
+/* as HUFF_encode, with the codes packed over threads (0 for one per
+   core).  The output is the same for any number of threads. */
+
+int GCALL HUFF_encode_mt(void *compresseddata, const void *source, int sourcesize, int *opts, int threads)
+{
+    return(HUFF_encodewith(compresseddata,source,sourcesize,opts,qmax(threads,0)));
+}
+
 #endif
@@ -2,16 +2,52 @@
 
 #pragma hdrstop
 
+#include <string.h>
+#include <atomic>
+#include <thread>
+#include "codex.h"
 #include "jdlz_compression.h"
 //---------------------------------------------------------------------------
 #pragma package(smart_init)
 
-int JDLZ_Decompress(unsigned char *in, int insz, unsigned char *out, int outsz)
+//copy a match of length bytes from t back, all of it fitting before outl.
+//Far matches go 16 bytes at a time when there is room for the overshoot.
+//Near ones repeat every t bytes, so the span already written is copied
+//again, doubling each time.
+static unsigned char *JDLZ_CopyMatch(unsigned char *o, int t, int length, unsigned char *outl)
+{
+	unsigned char *ref = o - t;
+	unsigned char *end = o + length;
+	int n;
+
+	if (t >= 16 && length + 16 <= outl - o)
+	{
+		do
+		{
+			memcpy(o, ref, 16);
+			o += 16;
+			ref += 16;
+		} while (o < end);
+		return end;
+	}
+	if (t == 1)
+	{
+		memset(o, *ref, length);
+		return end;
+	}
+	while (o < end)
+	{
+		n = (o - ref < end - o) ? (int)(o - ref) : (int)(end - o);
+		memcpy(o, ref, n);
+		o += n;
+	}
+	return end;
+}
+
+//the commands from in on, with the output written up to o and the flag
+//bytes in use. Every byte copied is checked against the end.
+static int JDLZ_Decompress_Tail(unsigned char *in, unsigned char *inl, unsigned char *out, unsigned char *o, unsigned char *outl, unsigned short flags1, unsigned short flags2)
 {
-    unsigned char *inl = in + insz;
-    unsigned char *o = out;
-    unsigned char *outl = out + outsz;
-    unsigned short flags1 = 1, flags2 = 1;
     int i, t, length;
 
     while ((in < inl) && (o < outl))
@@ -46,25 +82,182 @@ int JDLZ_Decompress(unsigned char *in, int insz, unsigned char *out, int outsz)
 	return o - out;
 }
 
-int JDLZ_Compress(unsigned char *input, int in_sz, unsigned char *output)
+//one command at a time, the plain loop JDLZ_Decompress was. Kept as the
+//reference for it and for the benchmark.
+int JDLZ_Decompress_Simple(unsigned char *in, int insz, unsigned char *out, int outsz)
 {
-	int hashSize = 0x2000;
-	int maxSearchDepth = 16;
-	const int MinMatchLength = 3;
-	int inputBytes = in_sz;
+	return JDLZ_Decompress_Tail(in, in + insz, out, out, out + outsz, 1, 1);
+}
+
+//The same output and return as JDLZ_Decompress_Simple. A whole group of
+//8 commands, one flags1 byte, is read with a single check while 18 bytes
+//of input are left, and each match is cut to the output left and copied
+//at once. The last few bytes of input go through the simple loop.
+int JDLZ_Decompress(unsigned char *in, int insz, unsigned char *out, int outsz)
+{
+	unsigned char *inl = in + insz;
+	unsigned char *o = out;
+	unsigned char *outl = out + outsz;
+	unsigned short flags1 = 1, flags2 = 1;
+	int t, length;
 
-	int *hashPos = new int[hashSize];
-	if (hashPos == nullptr)
+	while ((o < outl) && (inl - in >= 18))
 	{
-		return 0;
+		flags1 = *in++ | 0x100;
+		do
+		{
+			if (flags2 == 1) flags2 = *in++ | 0x100;
+			if (flags1 & 1)
+			{
+				if (flags2 & 1)
+				{
+					length = (in[1] | ((*in & 0xF0) << 4)) + 3;
+					t = (*in & 0xF) + 1;
+				}
+				else
+				{
+					t = (in[1] | ((*in & 0xE0) << 3)) + 17;
+					length = (*in & 0x1F) + 3;
+				}
+				in += 2;
+				if ((o - t) < out) return -1;
+				if (length > outl - o) length = outl - o;
+				o = JDLZ_CopyMatch(o, t, length, outl);
+				flags2 >>= 1;
+			}
+			else *o++ = *in++;
+			flags1 >>= 1;
+		} while ((flags1 != 1) && (o < outl));
+	}
+	return JDLZ_Decompress_Tail(in, inl, out, o, outl, flags1, flags2);
+}
+
+//The compressed data lies at the end of buf and is unpacked into its
+//start. Every command must end at or before the input read so far, or
+//it would overwrite data still to be decoded, so the stream is checked
+//as it goes and a buffer too small for it is refused.
+int JDLZ_Decompress_Inplace(unsigned char *buf, int bufsz, int insz, int outsz)
+{
+	if (insz < 0 || outsz < 0 || insz > bufsz || outsz > bufsz)
+		return -1;
+
+	unsigned char *in = buf + bufsz - insz;
+	unsigned char *inl = buf + bufsz;
+	unsigned char *o = buf;
+	unsigned char *outl = buf + outsz;
+	unsigned short flags1 = 1, flags2 = 1;
+	int i, t, length;
+
+	while ((in < inl) && (o < outl))
+	{
+		if (flags1 == 1) flags1 = *in++ | 0x100;
+		if (flags2 == 1)
+		{
+			if (in >= inl) return -1;
+			flags2 = *in++ | 0x100;
+		}
+		if (flags1 & 1)
+		{
+			if (inl - in < 2) return -1;
+			if (flags2 & 1)
+			{
+				length = (in[1] | ((*in & 0xF0) << 4)) + 3;
+				t = (*in & 0xF) + 1;
+			}
+			else
+			{
+				t = (in[1] | ((*in & 0xE0) << 3)) + 17;
+				length = (*in & 0x1F) + 3;
+			}
+			in += 2;
+			if ((o - t) < buf) return -1;
+			if (length > outl - o) length = outl - o;
+			if (length > in - o) return -1;
+			for (i = 0; i < length; i++)
+				o[i] = o[i - t];
+			o += length;
+			flags2 >>= 1;
+		}
+		else
+		{
+			if (in >= inl || o > in) return -1;
+			*o++ = *in++;
+		}
+		flags1 >>= 1;
 	}
+	return o - buf;
+}
+
+//The least bufsz - outsz for JDLZ_Decompress_Inplace: the furthest the
+//output runs ahead of the input read, measured from where the input
+//starts. Returns -1 if the data is truncated or corrupt.
+int JDLZ_Inplace_Margin(const unsigned char *in, int insz, int outsz)
+{
+	const unsigned char *start = in;
+	const unsigned char *inl = in + insz;
+	int o = 0, ahead = 0;
+	unsigned short flags1 = 1, flags2 = 1;
+	int t, length;
 
-	int *hashChain = new int[inputBytes];
-	if (hashChain == nullptr)
+	while ((in < inl) && (o < outsz))
+	{
+		if (flags1 == 1) flags1 = *in++ | 0x100;
+		if (flags2 == 1)
+		{
+			if (in >= inl) return -1;
+			flags2 = *in++ | 0x100;
+		}
+		if (flags1 & 1)
+		{
+			if (inl - in < 2) return -1;
+			if (flags2 & 1)
+			{
+				length = (in[1] | ((*in & 0xF0) << 4)) + 3;
+				t = (*in & 0xF) + 1;
+			}
+			else
+			{
+				t = (in[1] | ((*in & 0xE0) << 3)) + 17;
+				length = (*in & 0x1F) + 3;
+			}
+			in += 2;
+			if (o < t) return -1;
+			if (length > outsz - o) length = outsz - o;
+			o += length;
+			flags2 >>= 1;
+		}
+		else
+		{
+			if (in >= inl) return -1;
+			o++;
+			in++;
+		}
+		flags1 >>= 1;
+		if (o - (in - start) > ahead)
+			ahead = o - (int)(in - start);
+	}
+	if (o != outsz)
+		return -1;
+	return ahead + insz - outsz > 0 ? ahead + insz - outsz : 0;
+}
+
+//penalty is a cost in bytes added to every match: one is only taken when
+//it saves more than that over its literals, so the output has fewer and
+//longer matches and decodes faster. 0 weighs the size alone.
+int JDLZ_Compress(unsigned char *input, int in_sz, unsigned char *output, int penalty)
+{
+	const int maxSearchDepth = 16;
+	const int MinMatchLength = 3;
+	int inputBytes = in_sz;
+	if (penalty < 0) penalty = 0;
+
+	MATCHFINDER mf;
+	MFMATCH matches[maxSearchDepth];
+	if (!MF_init(&mf, MF_HASHBUCKET, 2064, maxSearchDepth, MinMatchLength, 4098, 4098, in_sz))
 	{
-		delete[] hashPos;
 		return 0;
 	}
+	MF_reset(&mf, input);
 
 	int outPos = 0;
 	int inPos = 0;
@@ -101,45 +294,27 @@ int JDLZ_Compress(unsigned char *input, int in_sz, unsigned char *output)
 
 		if (inputBytes >= MinMatchLength)
 		{
-			int hash = (-0x1A1 * (input[inPos] ^ ((input[inPos + 1] ^ (input[inPos + 2] << 4)) << 4))) & (hashSize - 1);
-			int matchPos = hashPos[hash];
-			hashPos[hash] = inPos;
-			hashChain[inPos] = matchPos;
-			int prevMatchPos = inPos;
+			int numMatches = MF_find(&mf, inPos, in_sz, matches);
 
-			for (int i = 0; i < maxSearchDepth; i++)
+			for (int i = 0; i < numMatches; i++)
 			{
-				int matchDist = inPos - matchPos;
-
-				if (matchDist > 2064 || matchPos >= prevMatchPos)
-					break;
-
+				int matchDist = matches[i].dist;
+				int matchLength = matches[i].len;
 				int matchLengthLimit = matchDist <= 16 ? 4098 : 34;
-				int maxMatchLength = inputBytes;
 
-				if (maxMatchLength > matchLengthLimit)
+				if (matchLength > matchLengthLimit)
 				{
-					maxMatchLength = matchLengthLimit;
+					matchLength = matchLengthLimit;
 				}
-				if (bestMatchLength >= maxMatchLength)
-					break;
-
-				int matchLength = 0;
-				while ((matchLength < maxMatchLength) && (input[inPos + matchLength] == input[matchPos + matchLength]))
-					matchLength++;
-
 				if (matchLength > bestMatchLength)
 				{
 					bestMatchLength = matchLength;
 					bestMatchDist = matchDist;
 				}
-
-				prevMatchPos = matchPos;
-				matchPos = hashChain[matchPos];
 			}
 		}
 
-		if (bestMatchLength >= MinMatchLength)
+		if (bestMatchLength >= MinMatchLength + penalty)
 		{
 			flags1 |= flags1bit;
 			inPos += bestMatchLength;
@@ -186,11 +361,13 @@ int JDLZ_Compress(unsigned char *input, int in_sz, unsigned char *output)
 		}
 	}
 
-	if (flags2bit > 1)
+	//a flags2 byte with no match after it is dropped if it is the last
+	//byte, and is still read by the decoder, so set, if it is not
+	if (flags2bit > 1 || flags2Pos != outPos - 1)
 	{
 		output[flags2Pos] = flags2;
 	}
-	else if (flags2Pos == outPos - 1)
+	else
 	{
 		outPos = flags2Pos;
 	}
@@ -204,8 +381,7 @@ int JDLZ_Compress(unsigned char *input, int in_sz, unsigned char *output)
 		outPos = flags1Pos;
 	}
 
-	delete[] hashPos;
-	delete[] hashChain;
+	MF_free(&mf);
 
 	output[12] = outPos;
 	output[13] = outPos >> 8;
@@ -213,3 +389,766 @@ int JDLZ_Compress(unsigned char *input, int in_sz, unsigned char *output)
 	output[15] = outPos >> 24;
 	return outPos;
 }
+
+//---------------------------------------------------------------------------
+//Optimal parse
+//
+//Both match forms take 2 bytes, a flags1 bit and a flags2 bit, and a
+//literal 1 byte and a flags1 bit, so in bits a match costs 18 and a
+//literal 9 wherever it is. What differs is what each form can hold: up
+//to 4098 bytes 1..16 back, or up to 34 bytes 17..2064 back. The parse
+//prices every length of every match the tree finds, a block of input at
+//a time, and keeps the cheapest way to reach each position. A block
+//runs on past its size until no match priced crosses its end, for up to
+//as much again, so the path is not cut in the middle of a long run.
+
+#define JDLZOPTBLOCK	4096	//positions priced per pass
+#define JDLZOPTNICE		256		//take a match this long without pricing
+#define JDLZOPTDEPTH	256		//tree candidates per position
+#define JDLZOPTMAX		4098	//longest match
+
+struct JDLZOptNode
+{
+	unsigned int price;			//bits to reach this position
+	int len;					//0 literal, else match length
+	int dist;
+};
+
+struct JDLZWriter
+{
+	unsigned char *out;
+	int outPos;
+	int flags1Pos, flags2Pos;
+	unsigned char flags1bit, flags2bit, flags1, flags2;
+};
+
+//one command, a literal of *lit if length is 0, as JDLZ_Compress writes it
+static void JDLZ_PutCommand(JDLZWriter *w, const unsigned char *lit, int dist, int length)
+{
+	if (length)
+	{
+		w->flags1 |= w->flags1bit;
+		length -= 3;
+		if (dist < 17)
+		{
+			w->flags2 |= w->flags2bit;
+			w->out[w->outPos++] = ((dist - 1) | ((length >> 4) & 0xF0));
+			w->out[w->outPos++] = length;
+		}
+		else
+		{
+			dist -= 17;
+			w->out[w->outPos++] = (length | ((dist >> 3) & 0xE0));
+			w->out[w->outPos++] = dist;
+		}
+		w->flags2bit <<= 1;
+	}
+	else
+		w->out[w->outPos++] = *lit;
+
+	w->flags1bit <<= 1;
+	if (w->flags1bit == 0)
+	{
+		w->out[w->flags1Pos] = w->flags1;
+		w->flags1 = 0;
+		w->flags1Pos = w->outPos++;
+		w->flags1bit = 1;
+	}
+	if (w->flags2bit == 0)
+	{
+		w->out[w->flags2Pos] = w->flags2;
+		w->flags2 = 0;
+		w->flags2Pos = w->outPos++;
+		w->flags2bit = 1;
+	}
+}
+
+//the header, with the compressed size left for JDLZ_PutEnd, and the
+//first two flag bytes
+static void JDLZ_PutBegin(JDLZWriter *w, unsigned char *output, int in_sz)
+{
+	memcpy(output, "JDLZ", 4);
+	output[4] = 0x02;
+	output[5] = 0x10;
+	output[6] = output[7] = 0;
+	output[8] = in_sz;
+	output[9] = in_sz >> 8;
+	output[10] = in_sz >> 16;
+	output[11] = in_sz >> 24;
+	w->out = output;
+	w->flags1Pos = 16;
+	w->flags2Pos = 17;
+	w->outPos = 18;
+	w->flags1bit = w->flags2bit = 1;
+	w->flags1 = w->flags2 = 0;
+}
+
+//the flag bytes still open, trimmed as JDLZ_Compress does, and the size
+static int JDLZ_PutEnd(JDLZWriter *w)
+{
+	unsigned char *output = w->out;
+
+	if (w->flags2bit > 1 || w->flags2Pos != w->outPos - 1)
+		output[w->flags2Pos] = w->flags2;
+	else
+		w->outPos = w->flags2Pos;
+	if (w->flags1bit > 1)
+		output[w->flags1Pos] = w->flags1;
+	else if (w->flags1Pos == w->outPos - 1)
+		w->outPos = w->flags1Pos;
+
+	output[12] = w->outPos;
+	output[13] = w->outPos >> 8;
+	output[14] = w->outPos >> 16;
+	output[15] = w->outPos >> 24;
+	return w->outPos;
+}
+
+//As JDLZ_Compress, but with the cheapest parse instead of the longest
+//match at each position. The penalty is added to every match in bytes.
+int JDLZ_Compress_Opt(unsigned char *input, int in_sz, unsigned char *output, int penalty)
+{
+	JDLZOptNode *node;
+	MFMATCH *matches;
+	MATCHFINDER mf;
+	JDLZWriter w;
+	unsigned int price, mprice;
+	int pos, last, reach, len, maxl, nummatch;
+	int i, j, k, l;
+
+	if (in_sz <= 0)
+		return JDLZ_Compress(input, in_sz, output, penalty);
+	if (penalty < 0) penalty = 0;
+	mprice = 18 + 8 * penalty;
+
+	node = (JDLZOptNode *)galloc((2 * JDLZOPTBLOCK + JDLZOPTMAX + 1) * sizeof(JDLZOptNode));
+	matches = (MFMATCH *)galloc(JDLZOPTMAX * sizeof(MFMATCH));
+	if (!node || !matches || !MF_init(&mf, MF_BINTREE, 2064, JDLZOPTDEPTH, 3, JDLZOPTNICE, JDLZOPTNICE, in_sz))
+	{
+		if (matches) gfree(matches);
+		if (node) gfree(node);
+		return 0;
+	}
+	MF_reset(&mf, input);
+	JDLZ_PutBegin(&w, output, in_sz);
+
+	//the first byte is a literal, as there is nothing to match yet
+	JDLZ_PutCommand(&w, input, 0, 0);
+	MF_skip(&mf, 0, in_sz);
+	pos = 1;
+
+	while (pos < in_sz)
+	{
+		last = in_sz - pos < JDLZOPTBLOCK ? in_sz - pos : JDLZOPTBLOCK;
+		reach = 0;
+		node[0].price = 0;
+		for (i = 1; i <= 2 * JDLZOPTBLOCK + JDLZOPTMAX; i++)
+			node[i].price = 0xffffffff;
+
+		for (i = 0; i < last || (i < reach && i < 2 * JDLZOPTBLOCK); i++)
+		{
+			//literal
+			price = node[i].price + 9;
+			if (price < node[i + 1].price)
+			{
+				node[i + 1].price = price;
+				node[i + 1].len = 0;
+			}
+
+			nummatch = MF_find(&mf, pos + i, in_sz, matches);
+			price = node[i].price + mprice;
+
+			//the longest match that fits a form
+			maxl = 0;
+			for (j = 0; j < nummatch; j++)
+			{
+				len = matches[j].dist <= 16 ? matches[j].len : (matches[j].len < 34 ? matches[j].len : 34);
+				if (len > maxl)
+				{
+					maxl = len;
+					k = j;
+				}
+			}
+			if (maxl < 3)
+				continue;
+
+			//long enough, take it and skip the positions it covers. The
+			//tree stops at the nice length, only a match up to 16 back can
+			//go on, so only such a match is extended
+			if (maxl >= JDLZOPTNICE)
+			{
+				len = in_sz - pos - i < JDLZOPTMAX ? in_sz - pos - i : JDLZOPTMAX;
+				while (maxl < len && input[pos + i + maxl] == input[pos + i + maxl - matches[k].dist])
+					maxl++;
+				if (price < node[i + maxl].price)
+				{
+					node[i + maxl].price = price;
+					node[i + maxl].len = maxl;
+					node[i + maxl].dist = matches[k].dist;
+				}
+				for (l = 1; l < maxl; l++)
+					MF_skip(&mf, pos + i + l, in_sz);
+				i += maxl - 1;
+				continue;
+			}
+			if (i + maxl > reach)
+				reach = i + maxl;
+
+			//every length of every match; the nearest match that reaches a
+			//length is tried first, a farther one only adds the lengths
+			//beyond it that its form can hold
+			l = 3;
+			for (j = 0; j < nummatch; j++)
+			{
+				len = matches[j].dist <= 16 ? matches[j].len : (matches[j].len < 34 ? matches[j].len : 34);
+				for (; l <= len; l++)
+				{
+					if (price < node[i + l].price)
+					{
+						node[i + l].price = price;
+						node[i + l].len = l;
+						node[i + l].dist = matches[j].dist;
+					}
+				}
+			}
+		}
+
+		//walk back from the end of the block, marking the path forward
+		last = i;
+		k = 0;
+		while (i > 0)
+		{
+			l = node[i].len ? node[i].len : 1;
+			node[i].price = k;	//reuse as forward link
+			k = i;
+			i -= l;
+		}
+
+		//emit the path
+		i = k;
+		j = 0;
+		while (j < last)
+		{
+			JDLZ_PutCommand(&w, input + pos + j, node[i].dist, node[i].len);
+			j = i;
+			i = node[i].price;
+		}
+		pos += last;
+	}
+
+	MF_free(&mf);
+	gfree(matches);
+	gfree(node);
+	return JDLZ_PutEnd(&w);
+}
+
+//---------------------------------------------------------------------------
+//Parallel encoder
+//
+//The input is cut into fixed blocks, each parsed greedily on its own with
+//the match finder primed from the 2064 bytes before it, so the output does
+//not depend on the number of threads. Matches stay inside their block. The
+//flag bytes cannot be written per block, as where a flags1 or flags2 group
+//ends depends on every command before it, so a block is kept as its
+//matches and the literal runs in front of them, and the join writes all
+//of them through one JDLZWriter. Each thread parses into a list of the
+//most matches a block can have and keeps only the ones found.
+
+#define JDLZMTBLOCK		262144
+#define JDLZMTHIST		2064
+#define JDLZMTMATCHES	(JDLZMTBLOCK / 3 + 1)	//at most, with the run after the last
+
+struct JDLZMTMatch
+{
+	int run;					//literals before the match
+	int dist;
+	int len;					//0 for the run the block ends on
+};
+
+struct JDLZMTBlock
+{
+	JDLZMTMatch *match;
+	int count;
+};
+
+struct JDLZMTJob
+{
+	unsigned char *input;
+	int size;
+	int count;
+	int penalty;
+	JDLZMTBlock *blocks;
+	std::atomic<int> next;
+	std::atomic<bool> failed;
+};
+
+static void JDLZ_MTBlock(MATCHFINDER *mf, unsigned char *input, int start, int size, int penalty, JDLZMTBlock *blk)
+{
+	MFMATCH matches[16];
+	int hist = start < JDLZMTHIST ? start : JDLZMTHIST;
+	int end = hist + (size - start < JDLZMTBLOCK ? size - start : JDLZMTBLOCK);
+	int pos, run, best, bestDist, num, len, limit, i;
+
+	MF_reset(mf, input + start - hist);
+	for (i = 0; i < hist; i++)
+		MF_skip(mf, i, end);
+
+	//as in JDLZ_Compress, the first byte of the input is a literal that
+	//is never matched against
+	pos = hist;
+	run = 0;
+	if (start == 0)
+	{
+		pos = 1;
+		run = 1;
+	}
+
+	blk->count = 0;
+	while (pos < end)
+	{
+		best = 2;
+		bestDist = 0;
+		if (end - pos >= 3)
+		{
+			num = MF_find(mf, pos, end, matches);
+			for (i = 0; i < num; i++)
+			{
+				len = matches[i].len;
+				limit = matches[i].dist <= 16 ? 4098 : 34;
+				if (len > limit)
+					len = limit;
+				if (len > best)
+				{
+					best = len;
+					bestDist = matches[i].dist;
+				}
+			}
+		}
+
+		if (best >= 3 + penalty)
+		{
+			blk->match[blk->count].run = run;
+			blk->match[blk->count].dist = bestDist;
+			blk->match[blk->count].len = best;
+			blk->count++;
+			pos += best;
+			run = 0;
+		}
+		else
+		{
+			pos++;
+			run++;
+		}
+	}
+	blk->match[blk->count].run = run;
+	blk->match[blk->count].dist = 0;
+	blk->match[blk->count].len = 0;
+	blk->count++;
+}
+
+static void JDLZ_MTWorker(JDLZMTJob *job)
+{
+	MATCHFINDER mf;
+	JDLZMTMatch *scratch;
+	JDLZMTBlock *blk;
+	int i;
+
+	scratch = (JDLZMTMatch *)galloc(JDLZMTMATCHES * sizeof(JDLZMTMatch));
+	if (!scratch || !MF_init(&mf, MF_HASHBUCKET, 2064, 16, 3, 4098, 4098, JDLZMTHIST + JDLZMTBLOCK))
+	{
+		if (scratch) gfree(scratch);
+		job->failed = true;
+		return;
+	}
+	while (!job->failed && (i = job->next++) < job->count)
+	{
+		blk = &job->blocks[i];
+		blk->match = scratch;
+		JDLZ_MTBlock(&mf, job->input, i * JDLZMTBLOCK, job->size, job->penalty, blk);
+		blk->match = (JDLZMTMatch *)galloc(blk->count * sizeof(JDLZMTMatch));
+		if (!blk->match)
+		{
+			job->failed = true;
+			break;
+		}
+		memcpy(blk->match, scratch, blk->count * sizeof(JDLZMTMatch));
+	}
+	MF_free(&mf);
+	gfree(scratch);
+}
+
+//As JDLZ_Compress, spread over threads (0 for one per core).
+int JDLZ_Compress_MT(unsigned char *input, int in_sz, unsigned char *output, int threads, int penalty)
+{
+	JDLZMTJob job;
+	JDLZWriter w;
+	std::thread *workers;
+	unsigned char *lit;
+	int zsize = 0;
+	int i, j, k;
+
+	if (in_sz <= 0)
+		return JDLZ_Compress(input, in_sz, output, penalty);
+	if (penalty < 0) penalty = 0;
+
+	job.input = input;
+	job.size = in_sz;
+	job.count = (in_sz + JDLZMTBLOCK - 1) / JDLZMTBLOCK;
+	job.penalty = penalty;
+	job.next = 0;
+	job.failed = false;
+	job.blocks = (JDLZMTBlock *)galloc(job.count * sizeof(JDLZMTBlock));
+	if (!job.blocks)
+		return 0;
+	for (i = 0; i < job.count; i++)
+		job.blocks[i].match = 0;
+
+	if (threads <= 0)
+		threads = (int)std::thread::hardware_concurrency();
+	if (threads < 1) threads = 1;
+	if (threads > job.count) threads = job.count;
+	workers = new std::thread[threads - 1];
+	for (i = 0; i < threads - 1; i++)
+		workers[i] = std::thread(JDLZ_MTWorker, &job);
+	JDLZ_MTWorker(&job);
+	for (i = 0; i < threads - 1; i++)
+		workers[i].join();
+	delete[] workers;
+
+	//join the blocks
+	if (!job.failed)
+	{
+		JDLZ_PutBegin(&w, output, in_sz);
+		lit = input;
+		for (i = 0; i < job.count; i++)
+		{
+			for (j = 0; j < job.blocks[i].count; j++)
+			{
+				for (k = job.blocks[i].match[j].run; k > 0; k--)
+					JDLZ_PutCommand(&w, lit++, 0, 0);
+				if (job.blocks[i].match[j].len)
+				{
+					JDLZ_PutCommand(&w, lit, job.blocks[i].match[j].dist, job.blocks[i].match[j].len);
+					lit += job.blocks[i].match[j].len;
+				}
+			}
+		}
+		zsize = JDLZ_PutEnd(&w);
+	}
+
+	for (i = 0; i < job.count; i++)
+		if (job.blocks[i].match)
+			gfree(job.blocks[i].match);
+	gfree(job.blocks);
+	return zsize;
+}
+
+//---------------------------------------------------------------------------
+//Stream encoder
+//
+//The input goes through a buffer of the history a match can reach (2064
+//bytes, 4 KB kept), a chunk and the lookahead of the longest match; once
+//a chunk is parsed everything moves down by a chunk. The commands are the
+//ones JDLZ_Compress writes, but a byte of output can only be pulled once
+//the flag bytes in front of it are known. A flags2 byte waits for the
+//next 8 matches, which may be far away on data that hardly compresses;
+//when more than JDLZSTREAMHOLD bytes wait behind one, its remaining bits
+//are fixed at 0 and the matches it still covers must be over 16 bytes
+//back. The memory used is about 400 KB whatever the size of the data.
+
+#define JDLZSTREAMHIST	4096
+#define JDLZSTREAMCHUNK	65536
+#define JDLZSTREAMLOOK	4098
+#define JDLZSTREAMBUF	(JDLZSTREAMHIST + JDLZSTREAMCHUNK + JDLZSTREAMLOOK)
+#define JDLZSTREAMHOLD	65536
+#define JDLZSTREAMOUT	(JDLZSTREAMHOLD + 2 * JDLZSTREAMBUF + 64)
+
+struct JDLZENCSTREAM
+{
+	MATCHFINDER mf;
+	unsigned char *buf;		//history, chunk and lookahead
+	unsigned char *out;		//commands not yet pulled
+	int fill;				//bytes in buf
+	int pos;				//next position to parse
+	int outlen;
+	int outpos;
+	unsigned int outbase;	//bytes of output before out[0]
+	int flags1Pos;			//flag bytes being filled, -1 once written
+	int flags2Pos;
+	unsigned char flags1bit, flags2bit, flags1, flags2;
+	int penalty;
+	unsigned int total;		//bytes pushed
+	int sourcesize;			//size given to begin, -1 if unknown
+	int finished;			//1 no more input, 2 all parsed
+};
+
+//the output that can be pulled ends at the first flag byte still open
+static int JDLZ_StreamReady(JDLZENCSTREAM *st)
+{
+	int ready = st->outlen;
+
+	if (st->finished < 2)
+	{
+		if (st->flags1Pos >= 0 && st->flags1Pos < ready) ready = st->flags1Pos;
+		if (st->flags2Pos >= 0 && st->flags2Pos < ready) ready = st->flags2Pos;
+	}
+	return ready;
+}
+
+//parse the buffer up to stop, the loop of JDLZ_Compress
+static void JDLZ_StreamParse(JDLZENCSTREAM *st, int stop)
+{
+	const int MinMatchLength = 3;
+	MFMATCH matches[16];
+	unsigned char *output = st->out;
+	int outPos = st->outlen;
+
+	while (st->pos < stop)
+	{
+		int bestMatchLength = MinMatchLength - 1;
+		int bestMatchDist = 0;
+
+		if (st->flags2Pos >= 0 && outPos - st->flags2Pos > JDLZSTREAMHOLD)
+		{
+			output[st->flags2Pos] = st->flags2;
+			st->flags2Pos = -1;
+		}
+
+		if (st->fill - st->pos >= MinMatchLength)
+		{
+			int numMatches = MF_find(&st->mf, st->pos, st->fill, matches);
+
+			for (int i = 0; i < numMatches; i++)
+			{
+				int matchDist = matches[i].dist;
+				int matchLength = matches[i].len;
+				int matchLengthLimit = matchDist <= 16 ? 4098 : 34;
+
+				if (matchDist <= 16 && st->flags2Pos < 0)
+				{
+					continue;	//flags2 already written with 0 for this match
+				}
+				if (matchLength > matchLengthLimit)
+				{
+					matchLength = matchLengthLimit;
+				}
+				if (matchLength > bestMatchLength)
+				{
+					bestMatchLength = matchLength;
+					bestMatchDist = matchDist;
+				}
+			}
+		}
+
+		if (bestMatchLength >= MinMatchLength + st->penalty)
+		{
+			st->flags1 |= st->flags1bit;
+			st->pos += bestMatchLength;
+			bestMatchLength -= MinMatchLength;
+
+			if (bestMatchDist < 17)
+			{
+				st->flags2 |= st->flags2bit;
+				output[outPos++] = ((bestMatchDist - 1) | ((bestMatchLength >> 4) & 0xF0));
+				output[outPos++] = bestMatchLength;
+			}
+			else
+			{
+				bestMatchDist -= 17;
+				output[outPos++] = (bestMatchLength | ((bestMatchDist >> 3) & 0xE0));
+				output[outPos++] = bestMatchDist;
+			}
+
+			st->flags2bit <<= 1;
+		}
+		else
+		{
+			output[outPos++] = st->buf[st->pos++];
+		}
+
+		st->flags1bit <<= 1;
+
+		if (st->flags1bit == 0)
+		{
+			output[st->flags1Pos] = st->flags1;
+			st->flags1 = 0;
+			st->flags1Pos = outPos++;
+			st->flags1bit = 1;
+		}
+
+		if (st->flags2bit == 0)
+		{
+			if (st->flags2Pos >= 0) output[st->flags2Pos] = st->flags2;
+			st->flags2 = 0;
+			st->flags2Pos = outPos++;
+			output[st->flags2Pos] = 0;
+			st->flags2bit = 1;
+		}
+	}
+	st->outlen = outPos;
+}
+
+//parse a chunk, or the rest of the input once it is finished, after
+//moving what is left of the output to the front of out
+static void JDLZ_StreamStep(JDLZENCSTREAM *st)
+{
+	int n = st->outpos;
+
+	memmove(st->out, st->out + n, st->outlen - n);
+	st->outlen -= n;
+	st->outpos = 0;
+	st->outbase += n;
+	if (st->flags1Pos >= 0) st->flags1Pos -= n;
+	if (st->flags2Pos >= 0) st->flags2Pos -= n;
+
+	if (st->total > 0 && st->pos == 0)
+	{
+		st->flags1bit <<= 1;	//the first byte is always a literal
+		st->out[st->outlen++] = st->buf[st->pos++];
+	}
+
+	if (st->finished)
+	{
+		JDLZ_StreamParse(st, st->fill);
+
+		if (st->flags2bit > 1 || st->flags2Pos != st->outlen - 1)
+		{
+			if (st->flags2Pos >= 0) st->out[st->flags2Pos] = st->flags2;
+		}
+		else
+			st->outlen = st->flags2Pos;
+
+		if (st->flags1bit > 1)
+			st->out[st->flags1Pos] = st->flags1;
+		else if (st->flags1Pos == st->outlen - 1)
+			st->outlen = st->flags1Pos;
+		st->finished = 2;
+	}
+	else
+	{
+		JDLZ_StreamParse(st, st->fill - JDLZSTREAMLOOK);
+
+		memmove(st->buf, st->buf + JDLZSTREAMCHUNK, st->fill - JDLZSTREAMCHUNK);
+		MF_shift(&st->mf, JDLZSTREAMCHUNK);
+		st->fill -= JDLZSTREAMCHUNK;
+		st->pos -= JDLZSTREAMCHUNK;
+	}
+}
+
+JDLZENCSTREAM *JDLZ_Stream_Encode_Begin(int sourcesize, int penalty)
+{
+	JDLZENCSTREAM *st = (JDLZENCSTREAM *)galloc(sizeof(JDLZENCSTREAM));
+	if (!st)
+		return 0;
+	memset(st, 0, sizeof(JDLZENCSTREAM));
+	st->buf = (unsigned char *)galloc(JDLZSTREAMBUF);
+	st->out = (unsigned char *)galloc(JDLZSTREAMOUT);
+	if (!st->buf || !st->out ||
+		!MF_init(&st->mf, MF_HASHBUCKET, 2064, 16, 3, 4098, 4098, sourcesize >= 0 ? sourcesize : JDLZSTREAMBUF))
+	{
+		JDLZ_Stream_Encode_End(st);
+		return 0;
+	}
+	MF_reset(&st->mf, st->buf);
+
+	st->sourcesize = sourcesize;
+	st->penalty = penalty > 0 ? penalty : 0;
+	JDLZ_Stream_Encode_Header(st, st->out);
+	st->flags1Pos = 16;
+	st->flags2Pos = 17;
+	st->out[16] = st->out[17] = 0;
+	st->outlen = 18;
+	st->flags1bit = st->flags2bit = 1;
+	return st;
+}
+
+//returns the bytes taken, fewer than sourcesize when the output has to
+//be pulled first
+int JDLZ_Stream_Encode_Push(JDLZENCSTREAM *st, const void *source, int sourcesize)
+{
+	int taken = 0;
+	int n;
+
+	while (taken < sourcesize && !st->finished)
+	{
+		if (st->fill == JDLZSTREAMBUF)
+		{
+			if (st->outpos < JDLZ_StreamReady(st))
+				break;
+			JDLZ_StreamStep(st);
+		}
+		n = JDLZSTREAMBUF - st->fill;
+		if (n > sourcesize - taken) n = sourcesize - taken;
+		memcpy(st->buf + st->fill, (const unsigned char *)source + taken, n);
+		st->fill += n;
+		taken += n;
+		st->total += n;
+	}
+	return taken;
+}
+
+//no more input; false if it does not add up to the size given to begin
+bool JDLZ_Stream_Encode_Finish(JDLZENCSTREAM *st)
+{
+	if (!st->finished)
+		st->finished = 1;
+	return st->sourcesize < 0 || (unsigned int)st->sourcesize == st->total;
+}
+
+//returns the bytes written to output, 0 once everything is out or until
+//more input is pushed
+int JDLZ_Stream_Encode_Pull(JDLZENCSTREAM *st, void *output, int size)
+{
+	int done = 0;
+	int n;
+
+	while (done < size)
+	{
+		if (st->outpos == JDLZ_StreamReady(st))
+		{
+			if (st->finished == 1 || (!st->finished && st->fill == JDLZSTREAMBUF))
+				JDLZ_StreamStep(st);
+			else
+				break;
+		}
+		n = JDLZ_StreamReady(st) - st->outpos;
+		if (n > size - done) n = size - done;
+		memcpy((unsigned char *)output + done, st->out + st->outpos, n);
+		st->outpos += n;
+		done += n;
+	}
+	return done;
+}
+
+//the 16 byte header to write over the start of the output once all of
+//it is pulled, the first one has no compressed size
+void JDLZ_Stream_Encode_Header(JDLZENCSTREAM *st, void *header)
+{
+	unsigned char *h = (unsigned char *)header;
+	unsigned int size = st->sourcesize >= 0 ? (unsigned int)st->sourcesize : st->total;
+	unsigned int zsize = st->finished == 2 ? st->outbase + st->outlen : 0;
+
+	memcpy(h, "JDLZ", 4);
+	h[4] = 0x02;
+	h[5] = 0x10;
+	h[6] = h[7] = 0;
+	h[8] = size;
+	h[9] = size >> 8;
+	h[10] = size >> 16;
+	h[11] = size >> 24;
+	h[12] = zsize;
+	h[13] = zsize >> 8;
+	h[14] = zsize >> 16;
+	h[15] = zsize >> 24;
+}
+
+void JDLZ_Stream_Encode_End(JDLZENCSTREAM *st)
+{
+	if (st)
+	{
+		MF_free(&st->mf);
+		if (st->out) gfree(st->out);
+		if (st->buf) gfree(st->buf);
+		gfree(st);
+	}
+}
@@ -3,8 +3,37 @@
 #ifndef jdlz_compressionH
 #define jdlz_compressionH
 //---------------------------------------------------------------------------
-#endif
+
+#include "matchfind.h"
 
 int JDLZ_Decompress(unsigned char *in, int insz, unsigned char *out, int outsz);
-int JDLZ_Compress(unsigned char *input, int in_sz, unsigned char *output);
+//the same result with every byte checked, for comparison
+int JDLZ_Decompress_Simple(unsigned char *in, int insz, unsigned char *out, int outsz);
+int JDLZ_Compress(unsigned char *input, int in_sz, unsigned char *output, int penalty = 0);
+//the cheapest parse over both match forms, for the best ratio
+int JDLZ_Compress_Opt(unsigned char *input, int in_sz, unsigned char *output, int penalty = 0);
+//the greedy parse in 256 KB blocks over threads, 0 for one per core. The
+//output does not depend on the number of threads
+int JDLZ_Compress_MT(unsigned char *input, int in_sz, unsigned char *output, int threads, int penalty = 0);
+
+//in place: the insz compressed bytes sit at the end of the bufsz buffer,
+//which must hold outsz plus the margin JDLZ_Inplace_Margin returns
+int JDLZ_Decompress_Inplace(unsigned char *buf, int bufsz, int insz, int outsz);
+int JDLZ_Inplace_Margin(const unsigned char *in, int insz, int outsz);
 
+//push/pull encoder in about 400 KB whatever the size of the data. Push
+//returns the bytes taken, fewer when the output has to be pulled first;
+//pull returns the bytes ready, 0 when more input is needed or the stream
+//is done. Begin takes the total size if it is known, else -1, and the
+//penalty of JDLZ_Compress. The output starts with a header without the
+//compressed size: write the one from JDLZ_Stream_Encode_Header over it
+//once everything is pulled.
+struct JDLZENCSTREAM;
+JDLZENCSTREAM *JDLZ_Stream_Encode_Begin(int sourcesize, int penalty = 0);
+int JDLZ_Stream_Encode_Push(JDLZENCSTREAM *st, const void *source, int sourcesize);
+bool JDLZ_Stream_Encode_Finish(JDLZENCSTREAM *st);
+int JDLZ_Stream_Encode_Pull(JDLZENCSTREAM *st, void *output, int size);
+void JDLZ_Stream_Encode_Header(JDLZENCSTREAM *st, void *header);
+void JDLZ_Stream_Encode_End(JDLZENCSTREAM *st);
+
+#endif
@@ -0,0 +1,277 @@
+//---------------------------------------------------------------------------
+
+#ifndef __MATCHFIND
+#define __MATCHFIND 1
+
+#include <string.h>
+#include "codex.h"
+#include "matchfind.h"
+
+/****************************************************************/
+/*  Internal Functions                                          */
+/****************************************************************/
+
+static unsigned int MF_hash(const struct MATCHFINDER *mf, const unsigned char *p)
+{
+    unsigned int v;
+
+    v = p[0] | (p[1]<<8) | (p[2]<<16);
+    if (mf->minmatch>3)
+        v |= (unsigned int) p[3]<<24;
+    return((v*2654435761U) >> (32-mf->hashbits));
+}
+
+/* extend a match of len bytes as far as limit, a word at a time */
+
+static int MF_extend(const unsigned char *cur, const unsigned char *ref, int len, int limit)
+{
+    unsigned long long a;
+    unsigned long long b;
+
+    while (len+8<=limit)
+    {
+        memcpy(&a,cur+len,8);
+        memcpy(&b,ref+len,8);
+        if (a!=b)
+        {
+#if defined(__GNUC__) && __BYTE_ORDER__==__ORDER_LITTLE_ENDIAN__
+            return(len+(__builtin_ctzll(a^b)>>3));
+#else
+            break;
+#endif
+        }
+        len += 8;
+    }
+    while (len<limit && cur[len]==ref[len])
+        ++len;
+    return(len);
+}
+
+/* search the bucket newest first, then push pos in front */
+
+static int MF_bucket(struct MATCHFINDER *mf, int pos, int limit, struct MFMATCH *matches)
+{
+    const unsigned char *cur = mf->base+pos;
+    int *bucket = mf->head + MF_hash(mf,cur)*MF_BUCKETSIZE;
+    int nummatch = 0;
+    int best = mf->minmatch-1;
+    int depth = qmin(mf->depth,MF_BUCKETSIZE);
+    int i;
+
+    if (matches)
+    {
+        for (i=0; i<depth; ++i)
+        {
+            int cand = bucket[i];
+            const unsigned char *ref;
+            int len;
+
+            if (cand<0 || pos-cand>mf->window)
+                break;
+            ref = mf->base+cand;
+            if (ref[best]!=cur[best] || ref[0]!=cur[0])
+                continue;
+            len = MF_extend(cur,ref,0,limit);
+            if (len>best)
+            {
+                best = len;
+                matches[nummatch].len = len;
+                matches[nummatch++].dist = pos-cand;
+                if (len>=limit)
+                    break;
+            }
+        }
+    }
+    memmove(bucket+1,bucket,(MF_BUCKETSIZE-1)*sizeof(int));
+    bucket[0] = pos;
+    return(nummatch);
+}
+
+/* walk the tree rooted at the hash head, re-rooting it at pos so the
+   subtrees on either side stay sorted (the lzma bt4 scheme) */
+
+static int MF_tree(struct MATCHFINDER *mf, int pos, int limit, struct MFMATCH *matches)
+{
+    const unsigned char *cur = mf->base+pos;
+    int *head = mf->head + MF_hash(mf,cur);
+    int mask = mf->cycsize-1;
+    int *ptr0 = mf->son + ((pos&mask)<<1) + 1;
+    int *ptr1 = mf->son + ((pos&mask)<<1);
+    int len0 = 0;
+    int len1 = 0;
+    int best = mf->minmatch-1;
+    int nummatch = 0;
+    int depth = mf->depth;
+    int cand = *head;
+
+    *head = pos;
+    for (;;)
+    {
+        int *pair;
+        const unsigned char *ref;
+        int len;
+
+        if (cand<0 || pos-cand>mf->window || depth--==0)
+        {
+            *ptr0 = *ptr1 = -1;
+            break;
+        }
+        pair = mf->son + ((cand&mask)<<1);
+        ref = mf->base+cand;
+        len = qmin(len0,len1);
+        if (ref[len]==cur[len])
+        {
+            len = MF_extend(cur,ref,len+1,limit);
+            if (len>best)
+            {
+                best = len;
+                if (matches)
+                {
+                    matches[nummatch].len = len;
+                    matches[nummatch++].dist = pos-cand;
+                }
+            }
+            if (len>=limit)
+            {
+                *ptr1 = pair[0];
+                *ptr0 = pair[1];
+                break;
+            }
+        }
+        if (ref[len]<cur[len])
+        {
+            *ptr1 = cand;
+            ptr1 = pair+1;
+            cand = *ptr1;
+            len1 = len;
+        }
+        else
+        {
+            *ptr0 = cand;
+            ptr0 = pair;
+            cand = *ptr0;
+            len0 = len;
+        }
+    }
+    return(nummatch);
+}
+
+/****************************************************************/
+/*  Match Finder Functions                                      */
+/****************************************************************/
+
+/* size is the number of bytes that will be indexed, used to keep the
+   tables small for small inputs */
+
+bool MF_init(struct MATCHFINDER *mf, int mode, int window, int depth, int minmatch, int nicematch, int maxmatch, int size)
+{
+    int span = qmax(qmin(window,size),1);
+    int heads;
+    int sons;
+
+    memset(mf,0,sizeof(*mf));
+    mf->mode = mode;
+    mf->window = window;
+    mf->depth = qmax(depth,1);
+    mf->minmatch = minmatch;
+    mf->nicematch = qmin(qmax(nicematch,minmatch),maxmatch);
+    mf->maxmatch = maxmatch;
+
+    if (mode==MF_BINTREE)
+    {
+        mf->hashbits = 8;
+        while (mf->hashbits<17 && (1<<mf->hashbits)<span)
+            ++mf->hashbits;
+        mf->cycsize = 1;
+        while (mf->cycsize<=span)
+            mf->cycsize <<= 1;
+        heads = 1<<mf->hashbits;
+        sons = 2*mf->cycsize;
+    }
+    else
+    {
+        mf->hashbits = 6;
+        while (mf->hashbits<16 && (MF_BUCKETSIZE<<mf->hashbits)<span*4)
+            ++mf->hashbits;
+        heads = MF_BUCKETSIZE<<mf->hashbits;
+        sons = 0;
+    }
+
+    /* buckets start on a cache line */
+
+    mf->mem = galloc((heads+sons)*sizeof(int)+64);
+    if (!mf->mem)
+        return(false);
+    mf->head = (int *) (((size_t) mf->mem+63) & ~(size_t) 63);
+    mf->son = sons ? mf->head+heads : 0;
+    return(true);
+}
+
+void MF_reset(struct MATCHFINDER *mf, const unsigned char *base)
+{
+    int heads = mf->mode==MF_BINTREE ? 1<<mf->hashbits : MF_BUCKETSIZE<<mf->hashbits;
+
+    mf->base = base;
+    memset(mf->head,-1,heads*sizeof(int));
+}
+
+/* every stored position drops by delta; the tree nodes keep their slots
+   since pos&mask does not change for a multiple of cycsize */
+
+void MF_shift(struct MATCHFINDER *mf, int delta)
+{
+    int n = mf->mode==MF_BINTREE ? (1<<mf->hashbits)+2*mf->cycsize : MF_BUCKETSIZE<<mf->hashbits;
+    int *p = mf->head;
+    int i;
+
+    for (i=0; i<n; ++i)
+        p[i] = p[i]>=delta ? p[i]-delta : -1;
+}
+
+void MF_free(struct MATCHFINDER *mf)
+{
+    if (mf->mem)
+        gfree(mf->mem);
+    mf->mem = 0;
+    mf->head = mf->son = 0;
+}
+
+/* end is one past the last readable byte.  The search compares at most
+   nicematch bytes; a match that reaches it is then extended up to
+   maxmatch. */
+
+int MF_find(struct MATCHFINDER *mf, int pos, int end, struct MFMATCH *matches)
+{
+    int limit = qmin(mf->nicematch,end-pos);
+    int nummatch;
+    struct MFMATCH *m;
+
+    if (limit<mf->minmatch)
+        return(0);
+    if (mf->mode==MF_BINTREE)
+        nummatch = MF_tree(mf,pos,limit,matches);
+    else
+        nummatch = MF_bucket(mf,pos,limit,matches);
+
+    if (nummatch)
+    {
+        m = matches+nummatch-1;
+        if (m->len==limit)
+            m->len = MF_extend(mf->base+pos,mf->base+pos-m->dist,limit,qmin(mf->maxmatch,end-pos));
+    }
+    return(nummatch);
+}
+
+void MF_skip(struct MATCHFINDER *mf, int pos, int end)
+{
+    int limit = qmin(mf->nicematch,end-pos);
+
+    if (limit<mf->minmatch)
+        return;
+    if (mf->mode==MF_BINTREE)
+        MF_tree(mf,pos,limit,0);
+    else
+        MF_bucket(mf,pos,limit,0);
+}
+
+#endif
@@ -0,0 +1,66 @@
+//---------------------------------------------------------------------------
+
+#ifndef matchfindH
+#define matchfindH
+
+/****************************************************************/
+/*  Match Finder                                                */
+/****************************************************************/
+
+/* Shared LZ match search used by the REF, JDLZ and COMP encoders.
+   Positions are offsets from the buffer given to MF_reset and must be
+   passed in increasing order; each one is indexed once, either by
+   MF_find (search, then insert) or by MF_skip (insert only). */
+
+#define MF_HASHBUCKET   0       /* hash of cache line sized buckets */
+#define MF_BINTREE      1       /* binary tree under each hash head */
+
+#define MF_BUCKETSIZE   16      /* positions per bucket (64 bytes) */
+
+struct MFMATCH
+{
+    int len;                    /* match length */
+    int dist;                   /* distance back, 1..window */
+};
+
+struct MATCHFINDER
+{
+    int             mode;       /* MF_HASHBUCKET or MF_BINTREE */
+    int             window;     /* furthest distance searched */
+    int             depth;      /* candidates tried per search */
+    int             minmatch;   /* bytes hashed, shortest match reported */
+    int             nicematch;  /* stop searching at this length */
+    int             maxmatch;   /* longest match reported */
+    int             hashbits;
+    int             cycsize;    /* tree mode: node pairs, power of 2 > window */
+    const unsigned char *base;
+    int             *head;      /* hash heads or buckets */
+    int             *son;       /* tree mode: left/right child pairs */
+    void            *mem;
+};
+
+bool MF_init(struct MATCHFINDER *mf, int mode, int window, int depth, int minmatch, int nicematch, int maxmatch, int size);
+void MF_reset(struct MATCHFINDER *mf, const unsigned char *base);
+void MF_free(struct MATCHFINDER *mf);
+
+/* the data has moved delta bytes down the buffer, positions before it
+   are forgotten.  In tree mode delta must be a multiple of cycsize. */
+
+void MF_shift(struct MATCHFINDER *mf, int delta);
+
+/* returns the number of matches written, each longer and no nearer than
+   the one before, so the last is the longest found */
+
+int  MF_find(struct MATCHFINDER *mf, int pos, int end, struct MFMATCH *matches);
+void MF_skip(struct MATCHFINDER *mf, int pos, int end);
+
+#ifndef qmin
+#define qmin(a,b) ((a)<(b)?(a):(b))
+#endif
+
+#ifndef qmax
+#define qmax(a,b) ((a)>(b)?(a):(b))
+#endif
+
+//---------------------------------------------------------------------------
+#endif
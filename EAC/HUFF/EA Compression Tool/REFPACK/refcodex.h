@@ -46,15 +46,125 @@ int        GCALL REF_decode(void *dest, const void *compresseddata, int *compres
 #else
 int        GCALL REF_decode(void *dest, const void *compresseddata, int *compressedsize);
 #endif
+int        GCALL REF_decode_safe(void *dest, int destcap, const void *compresseddata, int compressedsize);
 
 /* Encode Functions */
 
+/* opts[0] of REF_encode */
+
+#define REF_LEVEL_NORMAL    0   /* greedy parse */
+#define REF_LEVEL_MAX       1   /* optimal parse, best ratio, slower */
+#define REF_LEVEL_FAST      2   /* one hash probe per position, fastest */
+#define REF_LEVEL_MASK      0xff
+
+/* with REF_OPT_SEARCH or'd into opts[0], opts[1] is the most match
+   candidates tried per position and opts[2] the match length at which
+   the search stops (3..1028).  Together they bound the time spent on
+   each byte whatever the data; the defaults are 128/128 for the greedy
+   parse and 1024/256 for the optimal one. */
+
+#define REF_OPT_SEARCH      0x100
+
+/* with REF_OPT_DECODE or'd into opts[0], opts[3] is a cost in bytes
+   added to every command the parse writes.  Fewer, longer references
+   and literal blocks decode faster; a reference is only taken when it
+   saves more than the penalty, so short ones go first.  0 is the
+   plain size cost, 2..8 trade a few percent of ratio for decode speed. */
+
+#define REF_OPT_DECODE      0x200
+
 #ifdef __cplusplus
 int        GCALL REF_encode(void *compresseddata, const void *source, int sourcesize, int *opts=0);
 #else
 int        GCALL REF_encode(void *compresseddata, const void *source, int sourcesize, int *opts);
 #endif
 
+/* REF_encode split into 512 KB blocks over threads, 0 for one per core.
+   The output is the same for any number of threads. */
+
+int        GCALL REF_encode_mt(void *compresseddata, const void *source, int sourcesize, int *opts, int threads);
+
+/* Dictionary Functions */
+
+/* REF_encode_dict primes the history with the last 128 KB of dict, so
+   small sources can reference shared content; REF_decode_dict needs the
+   same dict and otherwise checks like REF_decode_safe.  REF_train_dict
+   builds a dictionary of up to dictcap bytes from samples laid end to
+   end and returns its size. */
+
+int        GCALL REF_encode_dict(void *compresseddata, const void *source, int sourcesize, const void *dict, int dictsize, int *opts);
+int        GCALL REF_decode_dict(void *dest, int destcap, const void *compresseddata, int compressedsize, const void *dict, int dictsize);
+int        GCALL REF_train_dict(void *dict, int dictcap, const void *samples, const int *samplesizes, int numsamples);
+
+/* Patch Functions */
+
+/* REF_encode_patch writes a patch that rebuilds source from old: REF
+   streams whose references reach into the parts of old the source
+   shares, so a file that changed a little patches to a few bytes per
+   32 KB.  The patch takes at most sourcesize*2+64 bytes.
+   REF_decode_patch needs the same old file, which REF_patch_sum checks;
+   REF_patch_size gives the size it rebuilds. */
+
+int        GCALL REF_encode_patch(void *patch, const void *source, int sourcesize, const void *old, int oldsize, int *opts);
+int        GCALL REF_decode_patch(void *dest, int destcap, const void *patch, int patchsize, const void *old, int oldsize);
+int        GCALL REF_patch_size(const void *patch);
+unsigned int GCALL REF_patch_sum(const void *data, int size);
+
+/* In Place Functions */
+
+/* REF_decode_inplace unpacks the compressedsize bytes at the end of
+   buffer into its start, so a load needs one buffer of ulen plus the
+   margin REF_inplace_margin returns for that data.  A smaller buffer is
+   refused, not overrun. */
+
+int        GCALL REF_decode_inplace(void *buffer, int buffersize, int compressedsize);
+int        GCALL REF_inplace_margin(const void *compresseddata, int compressedsize);
+
+/* Incremental Functions */
+
+/* For a source edited and encoded again and again.  REF_incr_encode
+   gives a valid stream, usually byte-identical to REF_encode at the
+   greedy level; the next call only parses again from just before the
+   first changed byte to 128 KB past the last, where the parse falls in
+   step with the old one, and copies the rest of the old commands.  The
+   parse again sees only the 128 KB before where it starts, so it can
+   pick other references than a whole encode would.  The state keeps a
+   copy of the source and its commands. */
+
+struct REFINCR;
+
+struct REFINCR *GCALL REF_incr_begin(int *opts);
+int        GCALL REF_incr_encode(struct REFINCR *state, void *compresseddata, const void *source, int sourcesize);
+void       GCALL REF_incr_end(struct REFINCR *state);
+
+/* Stream Functions */
+
+/* Push/pull encode and decode in bounded memory, about 2 MB to encode
+   and 200 KB to decode whatever the size of the data.  Push returns the
+   bytes taken, fewer when the output has to be pulled first.  Pull
+   returns the bytes ready, 0 when more input is needed or the stream is
+   done.  The encoder uses the greedy parse.
+
+   REF_stream_encode_begin takes the total size if it is known, else -1.
+   An unknown size gives a 6 byte 90fb header, to be overwritten with
+   the one from REF_stream_encode_header once the stream is finished. */
+
+struct REFENCSTREAM;
+struct REFDECSTREAM;
+
+struct REFENCSTREAM *GCALL REF_stream_encode_begin(int sourcesize);
+int        GCALL REF_stream_encode_push(struct REFENCSTREAM *stream, const void *source, int sourcesize);
+bool       GCALL REF_stream_encode_finish(struct REFENCSTREAM *stream);
+int        GCALL REF_stream_encode_pull(struct REFENCSTREAM *stream, void *compresseddata, int size);
+int        GCALL REF_stream_encode_header(struct REFENCSTREAM *stream, void *header);
+void       GCALL REF_stream_encode_end(struct REFENCSTREAM *stream);
+
+struct REFDECSTREAM *GCALL REF_stream_decode_begin(void);
+int        GCALL REF_stream_decode_push(struct REFDECSTREAM *stream, const void *compresseddata, int compressedsize);
+int        GCALL REF_stream_decode_pull(struct REFDECSTREAM *stream, void *dest, int size);
+bool       GCALL REF_stream_decode_done(struct REFDECSTREAM *stream);
+void       GCALL REF_stream_decode_end(struct REFDECSTREAM *stream);
+
 /****************************************************************/
 /*  Internal                                                    */
 /****************************************************************/
@@ -47,6 +47,56 @@ bool GCALL REF_is(const void *compresseddata)
 }
 
 
+/****************************************************************/
+/*  Internal Functions                                          */
+/****************************************************************/
+
+/* copy a reference of len bytes from dist bytes back and return the
+   new end.  Far references are copied 16 or 8 bytes at a time when
+   the destination has room for the overshoot.  Near ones repeat every
+   dist bytes, so the span already written is copied again, doubling
+   each time, and a run of one byte is a memset. */
+
+static unsigned char *refcopy(unsigned char *d, unsigned int dist, unsigned int len, unsigned char *dend)
+{
+    unsigned char *ref = d-dist;
+    unsigned char *end = d+len;
+    unsigned int n;
+
+    if (dist>=16 && len+16<=(unsigned int)(dend-d))
+    {
+        do
+        {
+            memcpy(d,ref,16);
+            d += 16;
+            ref += 16;
+        } while (d<end);
+        return(end);
+    }
+    if (dist>=8 && len+8<=(unsigned int)(dend-d))
+    {
+        do
+        {
+            memcpy(d,ref,8);
+            d += 8;
+            ref += 8;
+        } while (d<end);
+        return(end);
+    }
+    if (dist==1)
+    {
+        memset(d,*ref,len);
+        return(end);
+    }
+    while (d<end)
+    {
+        n = qmin((unsigned int)(d-ref),(unsigned int)(end-d));
+        memcpy(d,ref,n);
+        d += n;
+    }
+    return(end);
+}
+
 /****************************************************************/
 /*  Decode Functions                                            */
 /****************************************************************/
@@ -73,8 +123,8 @@ int GCALL REF_size(const void *compresseddata)
 int GCALL REF_decode(void *dest, const void *compresseddata, int *compressedsize)
 {
     unsigned char *s;
-    unsigned char *ref;
     unsigned char *d;
+    unsigned char *dend;
     unsigned char first;
     unsigned char second;
     unsigned char third;
@@ -112,6 +162,8 @@ int GCALL REF_decode(void *dest, const void *compresseddata, int *compressedsize
             ulen = (ulen<<8) + *s++;
         }
 
+        dend = d+ulen;
+
         for (;;)
         {
             first = *s++;
@@ -121,12 +173,7 @@ int GCALL REF_decode(void *dest, const void *compresseddata, int *compressedsize
                 run = first&3;
                 while (run--)
                     *d++ = *s++;
-                ref = d-1 - (((first&0x60)<<3) + second);
-                run = ((first&0x1c)>>2)+3-1;
-                do
-                {
-                    *d++ = *ref++;
-                } while (run--);
+                d = refcopy(d,(((first&0x60)<<3) + second)+1,((first&0x1c)>>2)+3,dend);
                 continue;
             }
             if (!(first&0x40))          /* int form */
@@ -136,14 +183,7 @@ int GCALL REF_decode(void *dest, const void *compresseddata, int *compressedsize
                 run = second>>6;
                 while (run--)
                     *d++ = *s++;
-
-                ref = d-1 - (((second&0x3f)<<8) + third);
-
-                run = (first&0x3f)+4-1;
-                do
-                {
-                    *d++ = *ref++;
-                } while (run--);
+                d = refcopy(d,(((second&0x3f)<<8) + third)+1,(first&0x3f)+4,dend);
                 continue;
             }
             if (!(first&0x20))          /* very int form */
@@ -154,21 +194,15 @@ int GCALL REF_decode(void *dest, const void *compresseddata, int *compressedsize
                 run = first&3;
                 while (run--)
                     *d++ = *s++;
-
-                ref = d-1 - (((first&0x10)>>4<<16) +  (second<<8) + third);
-
-                run = ((first&0x0c)>>2<<8) + forth + 5-1;
-                do
-                {
-                    *d++ = *ref++;
-                } while (run--);
+                d = refcopy(d,(((first&0x10)>>4<<16) +  (second<<8) + third)+1,((first&0x0c)>>2<<8) + forth + 5,dend);
                 continue;
             }
             run = ((first&0x1f)<<2)+4;  /* literal */
             if (run<=112)
             {
-                while (run--)
-                    *d++ = *s++;
+                memcpy(d,s,run);
+                d += run;
+                s += run;
                 continue;
             }
             run = first&3;              /* eof (+0..3 literal) */
@@ -182,5 +216,651 @@ int GCALL REF_decode(void *dest, const void *compresseddata, int *compressedsize
     return(ulen);
 }
 
+/* as REF_decode, but every command is checked against the end of the
+   compressed data and of dest before it is copied.  References may
+   reach back past the start of dest into the dictsize bytes ending at
+   dictend.  In place, the compressed data lies at the end of dest and
+   no command may write past the input it has read.  Returns the
+   unpacked size, or -1 if the data is truncated or corrupt or does not
+   fit in destcap bytes. */
+
+/* the header of s..send: the unpacked size in ulen, which has to fit
+   in destcap, and the first command, or 0 */
+
+static unsigned char *refsafeheader(unsigned char *s, unsigned char *send, int destcap, int *ulen)
+{
+    unsigned int  type;
+    int          ssize;
+
+    if (send-s<2)
+        return(0);
+    type = ggetm(s,2);
+    ssize = (type&0x8000) ? 4 : 3;
+    if (type&0x100)                               /* skip ulen */
+        s += ssize;
+    s += 2;
+    if (send-s<ssize+1)
+        return(0);
+    *ulen = ggetm(s,ssize);
+    s += ssize;
+    if (*ulen<0 || *ulen>destcap)
+        return(0);
+    return(s);
+}
+
+static int refdecodesafe(void *dest, int destcap, const void *compresseddata, int compressedsize, const unsigned char *dictend, unsigned int dictsize, bool inplace)
+{
+    unsigned char *s;
+    unsigned char *send;
+    unsigned char *d;
+    unsigned char *dend;
+    unsigned char first;
+    unsigned char second;
+    unsigned char third;
+    unsigned char forth;
+    unsigned int  run;
+    unsigned int  dist;
+    unsigned int  len;
+    unsigned int  back;
+    int          ulen;
+
+    s = (unsigned char *) compresseddata;
+    d = (unsigned char *) dest;
+    if (!s || !d || compressedsize<2)
+        return(-1);
+    send = s+compressedsize;
+    s = refsafeheader(s,send,destcap,&ulen);
+    if (!s)
+        return(-1);
+    dend = d+ulen;
+
+    for (;;)
+    {
+        first = *s++;
+        if (!(first&0x80))          /* short form */
+        {
+            if (send-s<1)
+                return(-1);
+            second = *s++;
+            run = first&3;
+            dist = (((first&0x60)<<3) + second)+1;
+            len = ((first&0x1c)>>2)+3;
+        }
+        else if (!(first&0x40))     /* int form */
+        {
+            if (send-s<2)
+                return(-1);
+            second = *s++;
+            third = *s++;
+            run = second>>6;
+            dist = (((second&0x3f)<<8) + third)+1;
+            len = (first&0x3f)+4;
+        }
+        else if (!(first&0x20))     /* very int form */
+        {
+            if (send-s<3)
+                return(-1);
+            second = *s++;
+            third = *s++;
+            forth = *s++;
+            run = first&3;
+            dist = (((first&0x10)>>4<<16) +  (second<<8) + third)+1;
+            len = ((first&0x0c)>>2<<8) + forth + 5;
+        }
+        else
+        {
+            run = ((first&0x1f)<<2)+4;  /* literal */
+            if (run>112)
+                run = first&3;          /* eof (+0..3 literal) */
+            len = 0;
+        }
+
+        if (run>(unsigned int)(send-s) || run>(unsigned int)(dend-d))
+            return(-1);
+        if (inplace)
+        {
+            if (d>s || len>(unsigned int)(s-d))
+                return(-1);
+            memmove(d,s,run);
+        }
+        else
+            memcpy(d,s,run);
+        d += run;
+        s += run;
+
+        if (len)
+        {
+            if (len>(unsigned int)(dend-d))
+                return(-1);
+            if (dist>(unsigned int)(d-(unsigned char *)dest))
+            {
+                back = dist-(unsigned int)(d-(unsigned char *)dest);
+                if (back>dictsize)
+                    return(-1);
+                run = qmin(back,len);   /* the part in the dictionary */
+                memcpy(d,dictend-back,run);
+                d += run;
+                len -= run;
+            }
+            if (len)
+                d = refcopy(d,dist,len,inplace ? qmin(dend,s) : dend);
+        }
+        else if (first>=0xfc)
+            break;
+        if (s>=send)
+            return(-1);
+    }
+    if (d!=dend)
+        return(-1);
+    return(ulen);
+}
+
+/* refdecodesafe without a dictionary or the in place rule, laid out as
+   REF_decode: the 0..3 literals before a reference are copied 4 bytes
+   at once when both ends have the room, the next command writing over
+   the extra ones. */
+
+static int refdecodeplain(void *dest, int destcap, const void *compresseddata, int compressedsize)
+{
+    unsigned char *s;
+    unsigned char *send;
+    unsigned char *d;
+    unsigned char *dend;
+    unsigned char first;
+    unsigned char second;
+    unsigned char third;
+    unsigned char forth;
+    unsigned int  run;
+    unsigned int  dist;
+    unsigned int  len;
+    int          ulen;
+
+    s = (unsigned char *) compresseddata;
+    d = (unsigned char *) dest;
+    if (!s || !d || compressedsize<2)
+        return(-1);
+    send = s+compressedsize;
+    s = refsafeheader(s,send,destcap,&ulen);
+    if (!s)
+        return(-1);
+    dend = d+ulen;
+
+    for (;;)
+    {
+        first = *s++;
+        if (!(first&0x80))          /* short form */
+        {
+            if (send-s<1)
+                return(-1);
+            second = *s++;
+            run = first&3;
+            dist = (((first&0x60)<<3) + second)+1;
+            len = ((first&0x1c)>>2)+3;
+        }
+        else if (!(first&0x40))     /* int form */
+        {
+            if (send-s<2)
+                return(-1);
+            second = *s++;
+            third = *s++;
+            run = second>>6;
+            dist = (((second&0x3f)<<8) + third)+1;
+            len = (first&0x3f)+4;
+        }
+        else if (!(first&0x20))     /* very int form */
+        {
+            if (send-s<3)
+                return(-1);
+            second = *s++;
+            third = *s++;
+            forth = *s++;
+            run = first&3;
+            dist = (((first&0x10)>>4<<16) +  (second<<8) + third)+1;
+            len = ((first&0x0c)>>2<<8) + forth + 5;
+        }
+        else
+        {
+            run = ((first&0x1f)<<2)+4;  /* literal */
+            if (run<=112)
+            {
+                if (run>=(unsigned int)(send-s) || run>(unsigned int)(dend-d))
+                    return(-1);
+                memcpy(d,s,run);
+                d += run;
+                s += run;
+                continue;
+            }
+            run = first&3;              /* eof (+0..3 literal) */
+            if (run>(unsigned int)(send-s) || run>(unsigned int)(dend-d))
+                return(-1);
+            while (run--)
+                *d++ = *s++;
+            break;
+        }
+
+        if (run+len>(unsigned int)(dend-d) || run>=(unsigned int)(send-s)
+         || dist>(unsigned int)(d-(unsigned char *)dest)+run)
+            return(-1);
+        if (send-s>=4 && dend-d>=4)
+            memcpy(d,s,4);
+        else
+            memcpy(d,s,run);
+        d += run;
+        s += run;
+        d = refcopy(d,dist,len,dend);
+    }
+    if (d!=dend)
+        return(-1);
+    return(ulen);
+}
+
+int GCALL REF_decode_safe(void *dest, int destcap, const void *compresseddata, int compressedsize)
+{
+    return(refdecodeplain(dest,destcap,compresseddata,compressedsize));
+}
+
+/* decodes the output of REF_encode_dict, given the same dictionary */
+
+int GCALL REF_decode_dict(void *dest, int destcap, const void *compresseddata, int compressedsize, const void *dict, int dictsize)
+{
+    if (!dict || dictsize<0)
+        dictsize = 0;
+    return(refdecodesafe(dest,destcap,compresseddata,compressedsize,(const unsigned char *)dict+dictsize,(unsigned int) dictsize,false));
+}
+
+/* FNV-1a over the old file, so a patch is not applied to the wrong one */
+
+unsigned int GCALL REF_patch_sum(const void *data, int size)
+{
+    const unsigned char *p = (const unsigned char *) data;
+    unsigned int sum = 2166136261u;
+    int i;
+
+    for (i=0; i<size; ++i)
+        sum = (sum^p[i])*16777619u;
+    return(sum);
+}
+
+int GCALL REF_patch_size(const void *patch)
+{
+    if (memcmp(patch,"RPAT",4))
+        return(-1);
+    return(ggetm((const char *)patch+12,4));
+}
+
+/* rebuilds the new file from old and a patch from REF_encode_patch.
+   Each segment is a REF stream whose dictionary is a window of old, or
+   of the new data already rebuilt when the window's top bit is set. */
+
+#define REFPATCHNEW     0x80000000
+
+int GCALL REF_decode_patch(void *dest, int destcap, const void *patch, int patchsize, const void *old, int oldsize)
+{
+    const unsigned char *s = (const unsigned char *) patch;
+    const unsigned char *send;
+    const unsigned char *base;
+    unsigned char *d = (unsigned char *) dest;
+    unsigned int win;
+    unsigned int wlen;
+    unsigned int zlen;
+    int ulen;
+    int pos;
+    int n;
+
+    if (!s || !d || patchsize<16 || memcmp(s,"RPAT",4))
+        return(-1);
+    if (!old || oldsize<0)
+        oldsize = 0;
+    send = s+patchsize;
+    ulen = ggetm(s+12,4);
+    if (ggetm(s+4,4)!=(unsigned int) oldsize || ggetm(s+8,4)!=REF_patch_sum(old,oldsize))
+        return(-1);
+    if (ulen<0 || ulen>destcap)
+        return(-1);
+    s += 16;
+
+    for (pos=0; pos<ulen; pos+=n)
+    {
+        if (send-s<12)
+            return(-1);
+        win = ggetm(s,4);
+        wlen = ggetm(s+4,4);
+        zlen = ggetm(s+8,4);
+        s += 12;
+        if (zlen>(unsigned int)(send-s) || wlen>131072)
+            return(-1);
+        if (win&REFPATCHNEW)
+        {
+            win &= ~REFPATCHNEW;
+            if (win>(unsigned int) pos || wlen>(unsigned int) pos-win)
+                return(-1);
+            base = d;
+        }
+        else
+        {
+            if (win>(unsigned int) oldsize || wlen>(unsigned int) oldsize-win)
+                return(-1);
+            base = (const unsigned char *) old;
+        }
+        n = refdecodesafe(d+pos,ulen-pos,s,zlen,base+win+wlen,wlen,false);
+        if (n<=0)
+            return(-1);
+        s += zlen;
+    }
+    if (s!=send)
+        return(-1);
+    return(ulen);
+}
+
+/* decodes the last compressedsize bytes of buffer into its start */
+
+int GCALL REF_decode_inplace(void *buffer, int buffersize, int compressedsize)
+{
+    if (!buffer || compressedsize<2 || compressedsize>buffersize)
+        return(-1);
+    return(refdecodesafe(buffer,buffersize,(char *)buffer+buffersize-compressedsize,compressedsize,0,0,true));
+}
+
+/* the least buffersize-ulen for REF_decode_inplace: the furthest any
+   command's output runs ahead of the input read so far, taken past the
+   point where the compressed data starts.  Returns -1 if the data is
+   truncated or corrupt. */
+
+int GCALL REF_inplace_margin(const void *compresseddata, int compressedsize)
+{
+    const unsigned char *s;
+    const unsigned char *send;
+    unsigned char first;
+    unsigned int  run;
+    unsigned int  dist;
+    unsigned int  len;
+    unsigned int  type;
+    int          ssize;
+    int          ulen;
+    int          o;
+    int          ahead;
+
+    s = (const unsigned char *) compresseddata;
+    if (!s || compressedsize<2)
+        return(-1);
+    send = s+compressedsize;
+
+    type = ggetm(s,2);
+    ssize = (type&0x8000) ? 4 : 3;
+    if (type&0x100)
+        s += ssize;
+    s += 2;
+    if (send-s<ssize+1)
+        return(-1);
+    ulen = ggetm(s,ssize);
+    s += ssize;
+    if (ulen<0)
+        return(-1);
+
+    o = 0;
+    ahead = 0;
+    for (;;)
+    {
+        first = *s++;
+        if (!(first&0x80))
+        {
+            if (send-s<1)
+                return(-1);
+            run = first&3;
+            dist = (((first&0x60)<<3) + s[0])+1;
+            len = ((first&0x1c)>>2)+3;
+            s += 1;
+        }
+        else if (!(first&0x40))
+        {
+            if (send-s<2)
+                return(-1);
+            run = s[0]>>6;
+            dist = (((s[0]&0x3f)<<8) + s[1])+1;
+            len = (first&0x3f)+4;
+            s += 2;
+        }
+        else if (!(first&0x20))
+        {
+            if (send-s<3)
+                return(-1);
+            run = first&3;
+            dist = (((first&0x10)>>4<<16) + (s[0]<<8) + s[1])+1;
+            len = ((first&0x0c)>>2<<8) + s[2] + 5;
+            s += 3;
+        }
+        else
+        {
+            run = ((first&0x1f)<<2)+4;
+            if (run>112)
+                run = first&3;
+            dist = 0;
+            len = 0;
+        }
+        if (run>(unsigned int)(send-s) || run+len>(unsigned int)(ulen-o) || dist>(unsigned int)o+run)
+            return(-1);
+        s += run;
+        o += run+len;
+        ahead = qmax(ahead,o-(int)(s-(const unsigned char *)compresseddata));
+        if (!len && first>=0xfc)
+            break;
+        if (s>=send)
+            return(-1);
+    }
+    if (o!=ulen)
+        return(-1);
+    return(qmax(0,ahead+compressedsize-ulen));
+}
+
+
+/****************************************************************/
+/*  Stream Decode Functions                                     */
+/****************************************************************/
+
+/* The window keeps the furthest a reference can reach behind the
+   output not yet pulled.  Commands are decoded only when whole in the
+   input and while the window has room for the longest one. */
+
+#define REFDECHIST      131072          /* furthest reference */
+#define REFDECWIN       (REFDECHIST+65536)
+#define REFDECIN        16384           /* compressed bytes buffered */
+#define REFDECCMD       (3+1028)        /* most output of one command */
+
+struct REFDECSTREAM
+{
+    unsigned char   in[REFDECIN];       /* compressed data not yet decoded */
+    int             inlen;
+    unsigned char   *win;               /* history and output not yet pulled */
+    int             fill;               /* bytes in win */
+    int             outpos;             /* first byte not yet pulled */
+    unsigned int    ulen;               /* size from the header */
+    unsigned int    total;              /* bytes decoded */
+    int             state;              /* 0 header, 1 commands, 2 eof, -1 corrupt */
+};
+
+static bool refstreamdecode(struct REFDECSTREAM *st)
+{
+    unsigned char *s = st->in;
+    unsigned char *send = st->in+st->inlen;
+    unsigned char *d = st->win+st->fill;
+    unsigned char *dend = st->win+REFDECWIN;
+    unsigned char first;
+    unsigned int  type;
+    unsigned int  run;
+    unsigned int  dist;
+    unsigned int  len;
+    unsigned int  clen;
+    int          ssize;
+    int          hlen;
+
+    if (st->state==0)
+    {
+        if (send-s<2)
+            return(true);
+        if (!REF_is(s))
+            return(false);
+        type = ggetm(s,2);
+        ssize = (type&0x8000) ? 4 : 3;
+        hlen = 2+ssize;
+        if (type&0x100)                           /* skip ulen */
+            hlen += ssize;
+        if (send-s<hlen)
+            return(true);
+        st->ulen = ggetm(s+hlen-ssize,ssize);
+        s += hlen;
+        st->state = 1;
+    }
+
+    while (st->state==1 && s<send && dend-d>=REFDECCMD)
+    {
+        first = s[0];
+        if (!(first&0x80))          /* short form */
+        {
+            if (send-s<2)
+                break;
+            clen = 2;
+            run = first&3;
+            dist = (((first&0x60)<<3) + s[1])+1;
+            len = ((first&0x1c)>>2)+3;
+        }
+        else if (!(first&0x40))     /* int form */
+        {
+            if (send-s<3)
+                break;
+            clen = 3;
+            run = s[1]>>6;
+            dist = (((s[1]&0x3f)<<8) + s[2])+1;
+            len = (first&0x3f)+4;
+        }
+        else if (!(first&0x20))     /* very int form */
+        {
+            if (send-s<4)
+                break;
+            clen = 4;
+            run = first&3;
+            dist = (((first&0x10)>>4<<16) + (s[1]<<8) + s[2])+1;
+            len = ((first&0x0c)>>2<<8) + s[3] + 5;
+        }
+        else
+        {
+            clen = 1;
+            run = ((first&0x1f)<<2)+4;  /* literal */
+            if (run>112)
+                run = first&3;          /* eof (+0..3 literal) */
+            len = 0;
+        }
+        if ((unsigned int)(send-s)<clen+run)
+            break;
+        if (run+len>st->ulen-st->total)
+            return(false);
+
+        memcpy(d,s+clen,run);
+        d += run;
+        s += clen+run;
+        st->total += run+len;
+        if (len)
+        {
+            if (dist>(unsigned int)(d-st->win))
+                return(false);
+            d = refcopy(d,dist,len,dend);
+        }
+        else if (first>=0xfc)
+        {
+            if (st->total!=st->ulen)
+                return(false);
+            st->state = 2;
+        }
+    }
+
+    st->inlen = (int)(send-s);
+    memmove(st->in,s,st->inlen);
+    st->fill = (int)(d-st->win);
+    return(true);
+}
+
+struct REFDECSTREAM *GCALL REF_stream_decode_begin(void)
+{
+    struct REFDECSTREAM *st;
+
+    st = (struct REFDECSTREAM *) galloc(sizeof(struct REFDECSTREAM));
+    if (!st)
+        return(0);
+    memset(st,0,sizeof(struct REFDECSTREAM));
+    st->win = (unsigned char *) galloc(REFDECWIN);
+    if (!st->win)
+    {
+        gfree(st);
+        return(0);
+    }
+    return(st);
+}
+
+/* returns the bytes taken, fewer than compressedsize when the output
+   has to be pulled first */
+
+int GCALL REF_stream_decode_push(struct REFDECSTREAM *st, const void *compresseddata, int compressedsize)
+{
+    int n = qmin(compressedsize,REFDECIN-st->inlen);
+
+    memcpy(st->in+st->inlen,compresseddata,n);
+    st->inlen += n;
+    return(n);
+}
+
+/* returns the bytes written to dest, 0 once the stream is done or until
+   more input is pushed, -1 if the data is corrupt */
+
+int GCALL REF_stream_decode_pull(struct REFDECSTREAM *st, void *dest, int size)
+{
+    int done = 0;
+    int fill;
+    int n;
+
+    if (st->state<0)
+        return(-1);
+    for (;;)
+    {
+        n = qmin(size-done,st->fill-st->outpos);
+        memcpy((char *)dest+done,st->win+st->outpos,n);
+        st->outpos += n;
+        done += n;
+        if (done==size || st->state==2)
+            break;
+
+        /* all pulled, keep only the history */
+
+        if (REFDECWIN-st->fill<REFDECCMD)
+        {
+            memmove(st->win,st->win+st->fill-REFDECHIST,REFDECHIST);
+            st->fill = st->outpos = REFDECHIST;
+        }
+        fill = st->fill;
+        if (!refstreamdecode(st))
+        {
+            st->state = -1;
+            return(-1);
+        }
+        if (st->fill==fill && st->state!=2)
+            break;
+    }
+    return(done);
+}
+
+/* true once the end of stream command is decoded and pulled */
+
+bool GCALL REF_stream_decode_done(struct REFDECSTREAM *st)
+{
+    return(st->state==2 && st->outpos==st->fill);
+}
+
+void GCALL REF_stream_decode_end(struct REFDECSTREAM *st)
+{
+    if (st)
+    {
+        if (st->win) gfree(st->win);
+        gfree(st);
+    }
+}
+
 #endif
 
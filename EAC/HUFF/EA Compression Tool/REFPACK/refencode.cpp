@@ -21,243 +21,1522 @@
 #ifndef __REFWRITE
 #define __REFWRITE 1
 
+#include <stdlib.h>
 #include <string.h>
+#include <atomic>
+#include <thread>
 #include "codex.h"
 #include "refcodex.h"
+#include "matchfind.h"
 
 /****************************************************************/
 /*  Internal Functions                                          */
 /****************************************************************/
 
-static unsigned int matchlen(unsigned char *s,unsigned char *d, unsigned int maxmatch)
+#define REFMAXMATCH 1028        /* longest reference */
+#define REFMFMODE   MF_BINTREE
+#define REFMFDEPTH  128         /* match finder candidates per position */
+#define REFMFNICE   128         /* stop searching at this length */
+
+/* cost in bytes of a reference command, 0 if no form can hold it */
+
+static unsigned int refcost(unsigned int offset, unsigned int len)
 {
-    unsigned int current;
+    if (offset<1024 && len>=3 && len<=10)       /* two byte int form */
+        return(2);
+    if (offset<16384 && len>=4 && len<=67)      /* three byte int form */
+        return(3);
+    if (offset<131072 && len>=5 && len<=1028)   /* four byte very int form */
+        return(4);
+    return(0);
+}
 
-    for (current=0; current<maxmatch && *s++==*d++; ++current)
-        ;
+/* literal blocks of a run, leaves the 0..3 remainder for the next command */
+
+static unsigned char *refputliterals(unsigned char *to, unsigned char **rptr, unsigned int *run)
+{
+    unsigned int tlen;
+
+    while (*run>3)                      /* literal block of data */
+    {
+        tlen = qmin(112,*run&~3);
+        *run -= tlen;
+        *to++ = (unsigned char) (0xe0+(tlen>>2)-1);
+        memcpy(to,*rptr,tlen);
+        *rptr += tlen;
+        to += tlen;
+    }
+    return(to);
+}
+
+/* reference command with the pending literal run in front of it */
+
+static unsigned char *refputmatch(unsigned char *to, unsigned char *rptr, unsigned int run, unsigned int boffset, unsigned int blen)
+{
+    unsigned int bcost;
 
-    return(current);
+    to = refputliterals(to,&rptr,&run);
+    bcost = refcost(boffset,blen);
+    if (bcost==2)                       /* two byte int form */
+    {
+        *to++ = (unsigned char) (((boffset>>8)<<5) + ((blen-3)<<2) + run);
+        *to++ = (unsigned char) boffset;
+    }
+    else if (bcost==3)                  /* three byte int form */
+    {
+        *to++ = (unsigned char) (0x80 + (blen-4));
+        *to++ = (unsigned char) ((run<<6) + (boffset>>8));
+        *to++ = (unsigned char) boffset;
+    }
+    else                                /* four byte very int form */
+    {
+        *to++ = (unsigned char) (0xc0 + ((boffset>>16)<<4) + (((blen-5)>>8)<<2) + run);
+        *to++ = (unsigned char) (boffset>>8);
+        *to++ = (unsigned char) (boffset);
+        *to++ = (unsigned char) (blen-5);
+    }
+    if (run)
+    {
+        memcpy(to, rptr, run);
+        to += run;
+    }
+    return(to);
 }
 
-#define HASH(cptr) (int)((((unsigned int)(unsigned char)cptr[0]<<8) | ((unsigned int)(unsigned char)cptr[2])) ^ ((unsigned int)(unsigned char)cptr[1]<<4))
+/* trailing literals and the end of stream command */
 
-static int refcompress(unsigned char *from, int len, unsigned char *dest, int maxback, int quick)
+static unsigned char *refputeof(unsigned char *to, unsigned char *rptr, unsigned int run)
+{
+    to = refputliterals(to,&rptr,&run);
+    *to++ = (unsigned char) (0xfc+run); /* end of stream command + 0..3 literal */
+    if (run)
+    {
+        memcpy(to,rptr,run);
+        to += run;
+    }
+    return(to);
+}
+
+/* the reference to take at pos, 0 for a literal.  len is the distance
+   to 4 bytes short of the end of the data.  A reference must save more
+   than penalty bytes over the literals it replaces. */
+
+static unsigned int refmatch(struct MATCHFINDER *mf, int pos, int len, unsigned int *boffset, unsigned int penalty)
 {
     unsigned int tlen;
     unsigned int tcost;
 //    unsigned int ccost;    // context cost
-    unsigned int run;
     unsigned int toffset;
-    unsigned int boffset;
     unsigned int blen;
     unsigned int bcost;
-    unsigned int mlen;
-    unsigned char *tptr;
-    unsigned char *cptr;
+    int nummatch;
+    int i;
+    struct MFMATCH matches[REFMAXMATCH];
+
+    *boffset = 0;
+    blen = 2;
+    bcost = 2;
+//    ccost = 0;
+    nummatch = MF_find(mf,pos,pos+len,matches);
+
+    for (i=0; i<nummatch; ++i)
+    {
+        tlen = matches[i].len;
+        toffset = matches[i].dist-1;
+        if (toffset<1024 && tlen<=10)       /* two byte int form */
+            tcost = 2;
+        else if (toffset<16384 && tlen<=67) /* three byte int form */
+            tcost = 3;
+        else                                /* four byte very int form */
+            tcost = 4;
+
+        if (tlen-tcost+4 > blen-bcost+4)
+        {
+            blen = tlen;
+            bcost = tcost;
+            *boffset = toffset;
+        }
+    }
+
+//    ccost = 0;
+//    if ((run<4) && ((run+blen)>=4))
+//        ccost = 1;  // extra packet cost to switch out of literal into reference
+
+//    if (bcost>blen || (blen<=2 && bcost==blen && !ccost) || (len<4))
+    if (bcost+penalty>=blen || len<4)
+        return(0);
+    return(blen);
+}
+
+/* greedy parse of from[*pos..stop), with the pending literal run from
+   *rptr up to *pos.  References end at least 4 bytes short of end, so
+   the parse may run past stop by up to one reference. */
+
+static unsigned char *refparse(struct MATCHFINDER *mf, unsigned char *from, int *pos, int stop, int end, unsigned char **rptr, unsigned int *run, unsigned char *to, int quick, unsigned int penalty)
+{
+    unsigned int boffset;
+    unsigned int blen;
+    int i;
+
+    while (*pos<stop)
+    {
+        blen = refmatch(mf,*pos,end-4-*pos,&boffset,penalty);
+        if (!blen)
+        {
+            ++*run;
+            ++*pos;
+        }
+        else
+        {
+            to = refputmatch(to,*rptr,*run,boffset,blen);
+            *run = 0;
+
+            if (!quick)
+            {
+                for (i=1; i < (int)blen; ++i)
+                    MF_skip(mf,*pos+i,end-4);
+            }
+            *pos += blen;
+            *rptr = from+*pos;
+        }
+    }
+    return(to);
+}
+
+/* hist bytes before from are history references may reach */
+
+static int refcompress(unsigned char *from, int hist, int len, unsigned char *dest, int maxback, int quick, int depth, int nice, unsigned int penalty)
+{
+    unsigned int run;
     unsigned char *to;
     unsigned char *rptr;
-    int countliterals=0;
-    int countshort=0;
-    int countint=0;
-    int countvint=0;
-    int hash;
-    int hoffset;
-    int minhoffset;
+    int pos;
     int i;
-    int *link;
-    int *hashtbl;
+    struct MATCHFINDER mf;
 
     to = dest;
     run = 0;
-    cptr = rptr = from;
+    pos = hist;
+    rptr = from;
 
     if ((unsigned int)maxback > (unsigned int)131071)
         maxback = 131071;
 
-	hashtbl = (int *) galloc(65536L*sizeof(int));
-	if (!hashtbl)
-        return(0);
-	link = (int *) galloc(131072L*sizeof(int));
-	if (!link)
+    if (!MF_init(&mf,REFMFMODE,maxback,depth,3,nice,REFMAXMATCH,hist+len))
         return(0);
+    MF_reset(&mf,from-hist);
+    for (i=0; i<hist; ++i)
+        MF_skip(&mf,i,hist+len);
+
+    to = refparse(&mf,from-hist,&pos,hist+len-3,hist+len,&rptr,&run,to,quick,penalty);
+    run += hist+len-pos;
+    to = refputeof(to,rptr,run);
+
+    MF_free(&mf);
+    return(to-dest);
+}
+
+
+/****************************************************************/
+/*  Fast Parse                                                  */
+/****************************************************************/
+
+/* One probe of a small hash table of 4 byte strings per position, no
+   chains and no tree.  A match is extended both ways, over the pending
+   literals too; after a run of misses the parse steps over more and
+   more bytes, so incompressible data costs little more than a copy.
+   The table is on the stack and only the hist bytes are put in it
+   before the parse. */
+
+#define REFFASTHASH     14              /* bits of the table */
+#define REFFASTSKIP     5               /* misses before the step grows */
+
+static unsigned int reffasthash(const unsigned char *p)
+{
+    unsigned int v;
+
+    memcpy(&v,p,4);
+    return((v*2654435761u) >> (32-REFFASTHASH));
+}
+
+static int refcompressfast(unsigned char *from, int hist, int len, unsigned char *dest, unsigned int penalty)
+{
+    int table[1<<REFFASTHASH];
+    unsigned char *base = from-hist;
+    unsigned char *limit = from+len-4;  /* references end 4 bytes short */
+    unsigned char *anchor = from;
+    unsigned char *ip = from;
+    unsigned char *ref;
+    unsigned char *to = dest;
+    unsigned long long a;
+    unsigned long long b;
+    unsigned int offset;
+    unsigned int mlen;
+    unsigned int mcost;
+    unsigned int maxlen;
+    unsigned int misses;
+    unsigned int h;
+    int i;
 
-    memset(hashtbl,-1,65536L*sizeof(int));
+    memset(table,0,sizeof(table));
+    for (i=qmax(hist-131072,0); i+4<=hist; ++i)
+        table[reffasthash(base+i)] = i+1;
 
-    len -= 4;
-    while (len>=0)
+    misses = 0;
+    while (ip+4<=limit)
     {
-        boffset = 0;
-        blen = 2;
-        bcost = 2;
-//        ccost = 0;
-        mlen = qmin(len,1028);
-        tptr=cptr-1;
-        hash = HASH(cptr);
-        hoffset = hashtbl[hash];
-        minhoffset = qmax(cptr-from-131071,0);
+        h = reffasthash(ip);
+        i = table[h]-1;
+        table[h] = (int) (ip-base)+1;
+        offset = (unsigned int) (ip-base-i)-1;
+        if (i<0 || offset>=131072 || memcmp(ip,base+i,4))
+        {
+            ip += 1+(misses++ >> REFFASTSKIP);
+            continue;
+        }
+        ref = base+i;
+
+        maxlen = qmin((unsigned int) (limit-ip),REFMAXMATCH);
+        mlen = 4;
+        while (mlen+8<=maxlen)
+        {
+            memcpy(&a,ip+mlen,8);
+            memcpy(&b,ref+mlen,8);
+            if (a!=b)
+                break;
+            mlen += 8;
+        }
+        while (mlen<maxlen && ip[mlen]==ref[mlen])
+            ++mlen;
+        while (ip>anchor && ref>base && mlen<REFMAXMATCH && ip[-1]==ref[-1])
+        {
+            --ip;
+            --ref;
+            ++mlen;
+        }
+        mcost = refcost(offset,mlen);
+        if (!mcost || mcost+penalty>=mlen)  /* 4 bytes too far for the 3 byte form */
+        {
+            ++ip;
+            continue;
+        }
+
+        to = refputmatch(to,anchor,(unsigned int) (ip-anchor),offset,mlen);
+        ip += mlen;
+        anchor = ip;
+        misses = 0;
+        table[reffasthash(ip-2)] = (int) (ip-2-base)+1;
+    }
+    to = refputeof(to,anchor,(unsigned int) (from+len-anchor));
+    return((int) (to-dest));
+}
+
 
+/****************************************************************/
+/*  Optimal Parse                                               */
+/****************************************************************/
 
-        if (hoffset>=minhoffset)
+/* Forward dynamic programming over the exact command costs.  The input is
+   priced a block at a time; each position keeps the cheapest way to reach
+   it and the length of the literal run that got there, since a run costs
+   an extra 0xe0 command byte every 112 literals (paid on the 4th).  The
+   penalty is added to the price of every command. */
+
+#define REFOPTBLOCK 4096        /* positions priced per pass */
+#define REFOPTNICE  256         /* take a match this long without pricing */
+#define REFOPTDEPTH 1024        /* tree candidates per position */
+
+struct RefOptNode
+{
+    unsigned int price;         /* bytes to reach this position */
+    unsigned int run;           /* literal run ending here */
+    unsigned int len;           /* 0 literal, else reference length */
+    unsigned int offset;        /* reference offset (distance-1) */
+};
+
+static int refcompressopt(unsigned char *from, int hist, int len, unsigned char *dest, int depth, int nice, unsigned int penalty)
+{
+    struct RefOptNode *node;
+    struct MFMATCH *matches;
+    struct MATCHFINDER mf;
+    unsigned char *cptr;
+    unsigned char *rptr;
+    unsigned char *to;
+    unsigned int run;
+    unsigned int blen;
+    unsigned int price;
+    unsigned int cost;
+    unsigned int offset;
+    unsigned int l;
+    int nummatch;
+    int pos;
+    int last;
+    int i;
+    int j;
+    int k;
+
+    to = dest;
+    run = 0;
+    cptr = rptr = from;
+
+    node = (struct RefOptNode *) galloc((REFOPTBLOCK+REFMAXMATCH+1)*sizeof(struct RefOptNode));
+    matches = (struct MFMATCH *) galloc(REFMAXMATCH*sizeof(struct MFMATCH));
+    if (!node || !matches || !MF_init(&mf,MF_BINTREE,131071,depth,3,nice,REFMAXMATCH,hist+len))
+    {
+        if (matches) gfree(matches);
+        if (node) gfree(node);
+        return(0);
+    }
+    MF_reset(&mf,from-hist);
+    for (i=0; i<hist; ++i)
+        MF_skip(&mf,i,hist+len);
+
+    while (cptr<from+len)
+    {
+        pos = (int) (cptr-from);
+        last = qmin(REFOPTBLOCK,len-pos);
+        node[0].price = 0;
+        node[0].run = run;
+        node[0].len = 0;
+        for (i=1; i<=last+REFMAXMATCH; ++i)
+            node[i].price = 0xffffffff;
+
+        for (i=0; i<last; ++i)
         {
-            do
+            /* literal */
+
+            price = node[i].price+1;
+            if ((node[i].run+1)%112==4)
+                price += 1+penalty;
+            if (price<node[i+1].price)
             {
-                tptr = from+hoffset;
-                if (cptr[blen]==tptr[blen])
+                node[i+1].price = price;
+                node[i+1].run = node[i].run+1;
+                node[i+1].len = 0;
+            }
+
+            nummatch = MF_find(&mf,hist+pos+i,hist+len,matches);
+            if (!nummatch)
+                continue;
+
+            /* long enough, take it and skip the positions it covers */
+
+            blen = matches[nummatch-1].len;
+            if (blen>=(unsigned int)nice)
+            {
+                price = node[i].price+4+penalty;
+                if (price<node[i+blen].price)
                 {
-                    tlen = matchlen(cptr,tptr,mlen);
-                    if (tlen > blen)
+                    node[i+blen].price = price;
+                    node[i+blen].run = 0;
+                    node[i+blen].len = blen;
+                    node[i+blen].offset = matches[nummatch-1].dist-1;
+                }
+                for (k=1; k<(int)blen; ++k)
+                    MF_skip(&mf,hist+pos+i+k,hist+len);
+                if (i+(int)blen>last)
+                    last = i+(int)blen;
+                i += blen-1;
+                continue;
+            }
+
+            /* price every length of every reference */
+
+            l = 3;
+            for (j=0; j<nummatch; ++j)
+            {
+                offset = matches[j].dist-1;
+                for (; l<=(unsigned int)matches[j].len; ++l)
+                {
+                    cost = refcost(offset,l);
+                    if (!cost)
+                        continue;
+                    price = node[i].price+cost+penalty;
+                    if (price<node[i+l].price)
                     {
-                        toffset = (cptr-1)-tptr;
-                        if (toffset<1024 && tlen<=10)       /* two byte int form */
-                            tcost = 2;
-                        else if (toffset<16384 && tlen<=67) /* three byte int form */
-                            tcost = 3;
-                        else                                /* four byte very int form */
-                            tcost = 4;
-
-                        if (tlen-tcost+4 > blen-bcost+4)
-                        {
-                            blen = tlen;
-                            bcost = tcost;
-                            boffset = toffset;
-                            if (blen>=1028) break;
-                        }
+                        node[i+l].price = price;
+                        node[i+l].run = 0;
+                        node[i+l].len = l;
+                        node[i+l].offset = offset;
                     }
                 }
-            } while ((hoffset = link[hoffset&131071]) >= minhoffset);
+            }
         }
 
-//        ccost = 0;
-//        if ((run<4) && ((run+blen)>=4))
-//            ccost = 1;  // extra packet cost to switch out of literal into reference
+        /* walk back from the end of the block, marking the path forward */
 
-//        if (bcost>blen || (blen<=2 && bcost==blen && !ccost) || (len<4))
-        if (bcost>=blen || len<4)
+        i = last;
+        k = 0;
+        while (i>0)
         {
-            hoffset = (cptr-from);
-            link[hoffset&131071] = hashtbl[hash];
-            hashtbl[hash] = hoffset;
-
-            ++run;
-            ++cptr;
-            --len;
+            l = node[i].len ? node[i].len : 1;
+            node[i].price = k;  /* reuse as forward link */
+            k = i;
+            i -= l;
         }
-        else
+
+        /* emit the path */
+
+        i = k;
+        j = 0;
+        while (j<last)
         {
-            while (run>3)                   /* literal block of data */
-            {
-                tlen = qmin(112,run&~3);
-                run -= tlen;
-                *to++ = (unsigned char) (0xe0+(tlen>>2)-1);
-                memcpy(to,rptr,tlen);
-                rptr += tlen;
-                to += tlen;
-                ++countliterals;
-            }
-            if (bcost==2)                   /* two byte int form */
-            {
-                *to++ = (unsigned char) (((boffset>>8)<<5) + ((blen-3)<<2) + run);
-                *to++ = (unsigned char) boffset;
-                ++countshort;
-            }
-            else if (bcost==3)              /* three byte int form */
-            {
-                *to++ = (unsigned char) (0x80 + (blen-4));
-                *to++ = (unsigned char) ((run<<6) + (boffset>>8));
-                *to++ = (unsigned char) boffset;
-                ++countint;
-            }
-            else                            /* four byte very int form */
+            if (node[i].len)
             {
-                *to++ = (unsigned char) (0xc0 + ((boffset>>16)<<4) + (((blen-5)>>8)<<2) + run);
-                *to++ = (unsigned char) (boffset>>8);
-                *to++ = (unsigned char) (boffset);
-                *to++ = (unsigned char) (blen-5);
-                ++countvint;
+                to = refputmatch(to,rptr,run,node[i].offset,node[i].len);
+                run = 0;
+                rptr = cptr+i;
             }
-            if (run)
+            else
+                ++run;
+            j = i;
+            i = node[i].price;
+        }
+        cptr += last;
+    }
+    to = refputeof(to,rptr,run);
+
+    MF_free(&mf);
+    gfree(matches);
+    gfree(node);
+    return(to-dest);
+}
+
+
+/* simple fb6 header, returns its length */
+
+static int refputheader(void *dest, unsigned int size, int size32)
+{
+    if (size32)
+    {
+        gputm(dest,   (unsigned int) 0x90fb, 2);
+        gputm((char *)dest+2, size, 4);
+        return(6);
+    }
+    gputm(dest,   (unsigned int) 0x10fb, 2);
+    gputm((char *)dest+2, size, 3);
+    return(5);
+}
+
+
+/* the level in opts and its search limits, the level's defaults unless
+   REF_OPT_SEARCH gives them, and the command penalty of REF_OPT_DECODE */
+
+static int reflevel(const int *opts, int *depth, int *nice, unsigned int *penalty)
+{
+    int level = opts ? opts[0]&REF_LEVEL_MASK : REF_LEVEL_NORMAL;
+
+    *depth = level==REF_LEVEL_MAX ? REFOPTDEPTH : REFMFDEPTH;
+    *nice = level==REF_LEVEL_MAX ? REFOPTNICE : REFMFNICE;
+    if (opts && (opts[0]&REF_OPT_SEARCH))
+    {
+        *depth = qmax(opts[1],1);
+        *nice = qmin(qmax(opts[2],3),REFMAXMATCH);
+    }
+    *penalty = 0;
+    if (opts && (opts[0]&REF_OPT_DECODE))
+        *penalty = (unsigned int) qmin(qmax(opts[3],0),REFMAXMATCH);
+    return(level);
+}
+
+
+/****************************************************************/
+/*  Encode Function                                             */
+/****************************************************************/
+
+int GCALL REF_encode(void *compresseddata, const void *source, int sourcesize, int *opts)
+{
+    int    maxback=131072;
+    int     quick=0;
+    int    level;
+    int    depth;
+    int    nice;
+    int    plen;
+    int    hlen;
+    unsigned int penalty;
+
+    level = reflevel(opts, &depth, &nice, &penalty);
+
+    hlen = refputheader(compresseddata, (unsigned int) sourcesize, sourcesize>0xffffff);  // 32 bit header required
+    if (level==REF_LEVEL_MAX)
+        plen = hlen+refcompressopt((unsigned char *)source, 0, sourcesize, (unsigned char *)compresseddata+hlen, depth, nice, penalty);
+    else if (level==REF_LEVEL_FAST)
+        plen = hlen+refcompressfast((unsigned char *)source, 0, sourcesize, (unsigned char *)compresseddata+hlen, penalty);
+    else
+        plen = hlen+refcompress((unsigned char *)source, 0, sourcesize, (unsigned char *)compresseddata+hlen, maxback, quick, depth, nice, penalty);
+    return(plen);
+}
+
+
+/****************************************************************/
+/*  Dictionary Functions                                        */
+/****************************************************************/
+
+#define REFDICTMAX      131072  /* history a reference can reach */
+#define REFDICTDMER     8       /* bytes scored together */
+#define REFDICTSEG      256     /* bytes taken from the samples at a time */
+#define REFDICTHASH     20
+
+struct RefDictSeg
+{
+    unsigned int    score;
+    int             pos;
+};
+
+static unsigned int refdicthash(const unsigned char *p)
+{
+    unsigned long long v;
+
+    memcpy(&v,p,8);
+    return((unsigned int) ((v*0x9e3779b97f4a7c15ULL) >> (64-REFDICTHASH)));
+}
+
+static int refdictcmp(const void *a, const void *b)
+{
+    const struct RefDictSeg *sa = (const struct RefDictSeg *) a;
+    const struct RefDictSeg *sb = (const struct RefDictSeg *) b;
+
+    if (sa->score!=sb->score)
+        return(sa->score<sb->score ? -1 : 1);
+    return(sa->pos-sb->pos);
+}
+
+/* as REF_encode, with the last 128 KB of dict as history before the
+   source.  The output needs the same dictionary to decode. */
+
+int GCALL REF_encode_dict(void *compresseddata, const void *source, int sourcesize, const void *dict, int dictsize, int *opts)
+{
+    unsigned char *buf;
+    int    level;
+    int    depth;
+    int    nice;
+    int    hist;
+    int    hlen;
+    int    plen;
+    unsigned int penalty;
+
+    hist = dict ? qmin(qmax(dictsize,0),REFDICTMAX) : 0;
+    buf = (unsigned char *) galloc(hist+sourcesize+1);
+    if (!buf)
+        return(0);
+    memcpy(buf,(const char *)dict+dictsize-hist,hist);
+    memcpy(buf+hist,source,sourcesize);
+
+    level = reflevel(opts, &depth, &nice, &penalty);
+    hlen = refputheader(compresseddata, (unsigned int) sourcesize, sourcesize>0xffffff);
+    if (level==REF_LEVEL_MAX)
+        plen = refcompressopt(buf+hist, hist, sourcesize, (unsigned char *)compresseddata+hlen, depth, nice, penalty);
+    else if (level==REF_LEVEL_FAST)
+        plen = refcompressfast(buf+hist, hist, sourcesize, (unsigned char *)compresseddata+hlen, penalty);
+    else
+        plen = refcompress(buf+hist, hist, sourcesize, (unsigned char *)compresseddata+hlen, 131072, 0, depth, nice, penalty);
+
+    gfree(buf);
+    return(plen ? hlen+plen : 0);
+}
+
+/* Builds a dictionary of up to dictcap bytes (at most 128 KB) from
+   samples laid end to end in memory.  Each 8 byte dmer scores the number
+   of samples it appears in, dmers found in only one sample score
+   nothing.  The samples are cut into one epoch per 256 byte segment of
+   the dictionary; the best scoring segment of each epoch is taken and
+   its dmers cleared, so later ones bring something new.  The best
+   segments go last, where references are shortest.  Returns the size
+   of the dictionary, 0 if the samples share nothing. */
+
+int GCALL REF_train_dict(void *dict, int dictcap, const void *samples, const int *samplesizes, int numsamples)
+{
+    const unsigned char *src = (const unsigned char *) samples;
+    unsigned char *to = (unsigned char *) dict;
+    unsigned int *freq;
+    unsigned int *seen;
+    struct RefDictSeg *segs;
+    unsigned int score;
+    int total;
+    int seglen;
+    int nseg;
+    int epoch;
+    int start;
+    int last;
+    int pos;
+    int i;
+    int j;
+
+    total = 0;
+    for (i=0; i<numsamples; ++i)
+        total += samplesizes[i];
+    dictcap = qmin(dictcap,REFDICTMAX);
+    if (dictcap<=0 || total<REFDICTDMER)
+        return(0);
+    seglen = qmin(REFDICTSEG,dictcap);
+    if (seglen<REFDICTDMER)
+        return(0);
+
+    freq = (unsigned int *) galloc((2<<REFDICTHASH)*sizeof(unsigned int));
+    segs = (struct RefDictSeg *) galloc((dictcap/seglen)*sizeof(struct RefDictSeg));
+    if (!freq || !segs)
+    {
+        if (segs) gfree(segs);
+        if (freq) gfree(freq);
+        return(0);
+    }
+    seen = freq+(1<<REFDICTHASH);
+    memset(freq,0,(1<<REFDICTHASH)*sizeof(unsigned int));
+    memset(seen,-1,(1<<REFDICTHASH)*sizeof(unsigned int));
+
+    /* samples each dmer appears in */
+
+    pos = 0;
+    for (i=0; i<numsamples; ++i)
+    {
+        for (j=0; j+REFDICTDMER<=samplesizes[i]; ++j)
+        {
+            unsigned int h = refdicthash(src+pos+j);
+
+            if (seen[h]!=(unsigned int) i)
             {
-                memcpy(to, rptr, run);
-                to += run;
-                run = 0;
+                seen[h] = i;
+                ++freq[h];
             }
+        }
+        pos += samplesizes[i];
+    }
+    if (numsamples>1)
+    {
+        for (i=0; i<(1<<REFDICTHASH); ++i)
+            if (freq[i]==1)
+                freq[i] = 0;
+    }
 
-            if (quick)
+    /* the best segment of each epoch, by a sliding sum of dmer scores */
+
+    nseg = qmax(qmin(dictcap/seglen,total/seglen),1);
+    for (epoch=0; epoch<nseg; ++epoch)
+    {
+        start = (int) ((long long) total*epoch/nseg);
+        last = qmin((int) ((long long) total*(epoch+1)/nseg),total-seglen);
+
+        segs[epoch].score = 0;
+        segs[epoch].pos = start;
+        if (start>last)
+            continue;
+        score = 0;
+        for (j=0; j<=seglen-REFDICTDMER; ++j)
+            score += freq[refdicthash(src+start+j)];
+        for (pos=start;; ++pos)
+        {
+            if (score>segs[epoch].score)
             {
-                hoffset = (cptr-from);
-                link[hoffset&131071] = hashtbl[hash];
-                hashtbl[hash] = hoffset;
-                cptr += blen;
+                segs[epoch].score = score;
+                segs[epoch].pos = pos;
             }
-            else
+            if (pos==last)
+                break;
+            score -= freq[refdicthash(src+pos)];
+            score += freq[refdicthash(src+pos+seglen-REFDICTDMER+1)];
+        }
+        for (j=0; j<=seglen-REFDICTDMER; ++j)
+            freq[refdicthash(src+segs[epoch].pos+j)] = 0;
+    }
+
+    qsort(segs,nseg,sizeof(struct RefDictSeg),refdictcmp);
+    for (i=0; i<nseg; ++i)
+    {
+        if (!segs[i].score)
+            continue;
+        memcpy(to,src+segs[i].pos,seglen);
+        to += seglen;
+    }
+
+    gfree(segs);
+    gfree(freq);
+    return((int) (to-(unsigned char *) dict));
+}
+
+/****************************************************************/
+/*  Patch Functions                                             */
+/****************************************************************/
+
+/* A patch cuts the new file into segments, each a REF stream decoded
+   with a window of the old file as its dictionary.  The window is
+   centred on where the segment's content moved to.  8 byte strings at
+   every third position of the segment are looked up in a hash chain
+   over every fourth position of the old file; the shifts most of them
+   agree on are tried against the shift of the segment before, and the
+   one under which most of the segment is found unchanged wins.  A
+   segment with nothing in the old file takes the new data before it
+   instead.  Window and segment fit in the 128 KB a reference can
+   reach. */
+
+#define REFPATCHSEG     32768           /* new bytes per segment */
+#define REFPATCHWIN     98304           /* most window bytes */
+#define REFPATCHSTEP    4               /* old positions indexed */
+#define REFPATCHCHAIN   8               /* old positions looked up per string */
+#define REFPATCHTRY     8               /* shifts tried per segment */
+#define REFPATCHNEW     0x80000000      /* window from the new data */
+
+static int refpatchcmp(const void *a, const void *b)
+{
+    int sa = *(const int *) a;
+    int sb = *(const int *) b;
+
+    return(sa<sb ? -1 : sa>sb);
+}
+
+/* the 8 byte blocks of the segment found unchanged shift bytes on in old */
+
+static int refpatchcover(const unsigned char *src, int start, int len, const unsigned char *old, int oldsize, int shift)
+{
+    int cover;
+    int i;
+
+    cover = 0;
+    for (i=qmax(start,-shift); i+REFDICTDMER<=start+len && i+shift+REFDICTDMER<=oldsize; i+=REFDICTDMER)
+        cover += !memcmp(src+i,old+i+shift,REFDICTDMER);
+    return(cover);
+}
+
+/* tries *shift and the REFPATCHTRY shifts most positions of the segment
+   vote for, keeps the one that covers most of it in *shift.  Returns
+   that cover, 0 only if nothing of the segment is in old. */
+
+static int refpatchshift(const unsigned char *src, int start, int len, const unsigned char *old, int oldsize, const int *head, const int *chain, int *votes, int *shift)
+{
+    int top[REFPATCHTRY];
+    int count[REFPATCHTRY];
+    int nvote;
+    int best;
+    int cover;
+    int run;
+    int q;
+    int i;
+    int j;
+
+    nvote = 0;
+    for (i=start; i+REFDICTDMER<=start+len; i+=REFPATCHSTEP-1)
+    {
+        q = head[refdicthash(src+i)];
+        for (j=0; q && j<REFPATCHCHAIN; ++j)
+        {
+            if (!memcmp(src+i,old+q-1,REFDICTDMER))
+                votes[nvote++] = q-1-i;
+            q = chain[(q-1)/REFPATCHSTEP];
+        }
+    }
+    best = refpatchcover(src,start,len,old,oldsize,*shift);
+    if (!nvote)
+        return(best);
+    qsort(votes,nvote,sizeof(int),refpatchcmp);
+
+    for (j=0; j<REFPATCHTRY; ++j)
+        count[j] = 0;
+    for (i=0; i<nvote; i+=run)
+    {
+        for (run=1; i+run<nvote && votes[i+run]==votes[i]; ++run)
+            ;
+        for (j=REFPATCHTRY; j>0 && run>count[j-1]; --j)
+        {
+            if (j<REFPATCHTRY)
             {
-                for (i=0; i < (int)blen; ++i)
-                {
-                    hash = HASH(cptr);
-                    hoffset = (cptr-from);
-                    link[hoffset&131071] = hashtbl[hash];
-                    hashtbl[hash] = hoffset;
-                    ++cptr;
-                }
+                top[j] = top[j-1];
+                count[j] = count[j-1];
             }
+        }
+        if (j<REFPATCHTRY)
+        {
+            top[j] = votes[i];
+            count[j] = run;
+        }
+    }
+    for (j=0; j<REFPATCHTRY && count[j]; ++j)
+    {
+        cover = refpatchcover(src,start,len,old,oldsize,top[j]);
+        if (cover>best)
+        {
+            best = cover;
+            *shift = top[j];
+        }
+    }
+    return(qmax(best,1));
+}
+
+/* writes a patch that rebuilds source from old, of at most
+   sourcesize*2+64 bytes, and returns its size */
+
+int GCALL REF_encode_patch(void *patch, const void *source, int sourcesize, const void *old, int oldsize, int *opts)
+{
+    const unsigned char *src = (const unsigned char *) source;
+    const unsigned char *base = (const unsigned char *) old;
+    unsigned char *to = (unsigned char *) patch;
+    unsigned char *buf;
+    int *head;
+    int *chain;
+    int *votes;
+    int level;
+    int depth;
+    int nice;
+    int start;
+    int len;
+    int shift;
+    unsigned int penalty;
+    int win;
+    int wlen;
+    int hlen;
+    int plen;
+    int i;
 
-            rptr = cptr;
-            len -= blen;
+    if (!old || oldsize<0)
+        oldsize = 0;
+    buf = (unsigned char *) galloc(REFPATCHWIN+REFPATCHSEG+1);
+    head = (int *) galloc((1<<REFDICTHASH)*sizeof(int));
+    chain = (int *) galloc((oldsize/REFPATCHSTEP+1)*sizeof(int));
+    votes = (int *) galloc(REFPATCHSEG*REFPATCHCHAIN*sizeof(int));
+    if (!buf || !head || !chain || !votes)
+    {
+        gfree(votes);
+        gfree(chain);
+        gfree(head);
+        gfree(buf);
+        return(0);
+    }
+    memset(head,0,(1<<REFDICTHASH)*sizeof(int));
+    for (i=0; i+REFDICTDMER<=oldsize; i+=REFPATCHSTEP)
+    {
+        chain[i/REFPATCHSTEP] = head[refdicthash(base+i)];
+        head[refdicthash(base+i)] = i+1;
+    }
+
+    memcpy(to,"RPAT",4);
+    gputm(to+4,(unsigned int) oldsize,4);
+    gputm(to+8,REF_patch_sum(old,oldsize),4);
+    gputm(to+12,(unsigned int) sourcesize,4);
+    to += 16;
+
+    level = reflevel(opts, &depth, &nice, &penalty);
+    shift = 0;
+    for (start=0; start<sourcesize; start+=len)
+    {
+        len = qmin(sourcesize-start,REFPATCHSEG);
+        if (refpatchshift(src,start,len,base,oldsize,head,chain,votes,&shift))
+        {
+            win = start+shift-(REFPATCHWIN-REFPATCHSEG)/2;
+            win = qmax(qmin(win,oldsize-REFPATCHWIN),0);
+            wlen = qmin(oldsize-win,REFPATCHWIN);
+            memcpy(buf,base+win,wlen);
+            gputm(to,(unsigned int) win,4);
+        }
+        else
+        {
+            win = qmax(start-REFPATCHWIN,0);
+            wlen = start-win;
+            memcpy(buf,src+win,wlen);
+            gputm(to,(unsigned int) win|REFPATCHNEW,4);
+        }
+        memcpy(buf+wlen,src+start,len);
+        gputm(to+4,(unsigned int) wlen,4);
+
+        hlen = refputheader(to+12,(unsigned int) len,0);
+        if (level==REF_LEVEL_MAX)
+            plen = refcompressopt(buf+wlen,wlen,len,to+12+hlen,depth,nice,penalty);
+        else if (level==REF_LEVEL_FAST)
+            plen = refcompressfast(buf+wlen,wlen,len,to+12+hlen,penalty);
+        else
+            plen = refcompress(buf+wlen,wlen,len,to+12+hlen,131072,0,depth,nice,penalty);
+        if (!plen)
+        {
+            to = (unsigned char *) patch;
+            break;
         }
+        gputm(to+8,(unsigned int) (hlen+plen),4);
+        to += 12+hlen+plen;
     }
-    len += 4;
-    run += len;
-    while (run>3)                       /* no match at end, use literal */
+
+    gfree(votes);
+    gfree(chain);
+    gfree(head);
+    gfree(buf);
+    return((int) (to-(unsigned char *) patch));
+}
+
+
+/****************************************************************/
+/*  Parallel Encode                                             */
+/****************************************************************/
+
+/* The input is cut into fixed blocks, each parsed on its own with the
+   match finder primed from the 128 KB before it, so the output does not
+   depend on the number of threads.  References stay inside their block.
+   A block is kept as the literals before its first reference, that
+   reference, the commands after it and the literals it ends on; the
+   join merges the leading literals with the run the block before left
+   and writes a single stream. */
+
+#define REFMTBLOCK      524288
+#define REFMTHIST       131072
+#define REFMTOUT        (REFMTBLOCK+REFMTBLOCK/64+16)
+
+struct RefBlock
+{
+    unsigned char   *out;       /* commands after the first reference */
+    int             outlen;
+    unsigned int    lead;       /* literals before the first reference */
+    unsigned int    offset;     /* first reference, len 0 if none */
+    unsigned int    len;
+    unsigned int    run;        /* literals left at the end */
+};
+
+struct RefJob
+{
+    unsigned char   *from;
+    int             size;
+    int             count;
+    int             depth;
+    int             nice;
+    unsigned int    penalty;
+    struct RefBlock *blocks;
+    std::atomic<int> next;
+    std::atomic<bool> failed;
+};
+
+static void refblock(struct MATCHFINDER *mf, unsigned char *from, int start, int size, unsigned int penalty, struct RefBlock *blk)
+{
+    int hist = qmin(start,REFMTHIST);
+    int blocklen = qmin(REFMTBLOCK,size-start);
+    unsigned char *base = from+start-hist;
+    unsigned char *rptr;
+    unsigned int boffset;
+    unsigned int blen;
+    unsigned int run;
+    int stop;
+    int end;
+    int pos;
+    int i;
+
+    /* the last block may reference up to its end, the others stop 4
+       bytes short of the next block's data */
+
+    end = hist+blocklen;
+    if (start+blocklen<size)
     {
-        tlen = qmin(112,run&~3);
-        run -= tlen;
-        *to++ = (unsigned char) (0xe0+(tlen>>2)-1);
-        memcpy(to,rptr,tlen);
-        rptr += tlen;
-        to += tlen;
+        stop = end;
+        end += 4;
     }
+    else
+        stop = end-3;
 
-    *to++ = (unsigned char) (0xfc+run); /* end of stream command + 0..3 literal */
-    if (run)
+    MF_reset(mf,base);
+    for (i=0; i<hist; ++i)
+        MF_skip(mf,i,hist+blocklen);
+
+    blen = 0;
+    pos = hist;
+    while (pos<stop && !(blen = refmatch(mf,pos,end-4-pos,&boffset,penalty)))
+        ++pos;
+
+    blk->outlen = 0;
+    blk->len = blen;
+    if (blen)
     {
-        memcpy(to,rptr,run);
-        to += run;
+        blk->lead = pos-hist;
+        blk->offset = boffset;
+        for (i=1; i < (int)blen; ++i)
+            MF_skip(mf,pos+i,end-4);
+        pos += blen;
+
+        rptr = base+pos;
+        run = 0;
+        blk->outlen = (int)(refparse(mf,base,&pos,stop,end,&rptr,&run,blk->out,0,penalty)-blk->out);
+        blk->run = run+hist+blocklen-pos;
     }
+    else
+        blk->lead = blocklen;
+}
 
-	gfree(link);
-	gfree(hashtbl);
-    return(to-dest);
+static void refworker(struct RefJob *job)
+{
+    struct MATCHFINDER mf;
+    int i;
+
+    if (!MF_init(&mf,REFMFMODE,131071,job->depth,3,job->nice,REFMAXMATCH,REFMTHIST+REFMTBLOCK))
+    {
+        job->failed = true;
+        return;
+    }
+    while (!job->failed && (i = job->next++) < job->count)
+        refblock(&mf,job->from,i*REFMTBLOCK,job->size,job->penalty,&job->blocks[i]);
+    MF_free(&mf);
 }
 
+/* as REF_encode with the greedy parse, spread over threads (0 for one
+   per core).  REF_LEVEL_MAX and REF_LEVEL_FAST are passed on to
+   REF_encode. */
+
+int GCALL REF_encode_mt(void *compresseddata, const void *source, int sourcesize, int *opts, int threads)
+{
+    struct RefJob job;
+    struct RefBlock *blk;
+    std::thread *workers;
+    unsigned char *out;
+    unsigned char *rptr;
+    unsigned char *to;
+    unsigned int run;
+    int level;
+    int i;
+
+    level = reflevel(opts,&job.depth,&job.nice,&job.penalty);
+    if (level==REF_LEVEL_MAX || level==REF_LEVEL_FAST || sourcesize<0)
+        return(REF_encode(compresseddata,source,sourcesize,opts));
+
+    job.from = (unsigned char *) source;
+    job.size = sourcesize;
+    job.count = qmax((sourcesize+REFMTBLOCK-1)/REFMTBLOCK,1);
+    job.next = 0;
+    job.failed = false;
+    job.blocks = (struct RefBlock *) galloc(job.count*sizeof(struct RefBlock));
+    out = (unsigned char *) galloc((size_t) job.count*REFMTOUT);
+    if (!job.blocks || !out)
+    {
+        if (out) gfree(out);
+        if (job.blocks) gfree(job.blocks);
+        return(0);
+    }
+    for (i=0; i<job.count; ++i)
+        job.blocks[i].out = out+(size_t) i*REFMTOUT;
+
+    if (threads<=0)
+        threads = (int) std::thread::hardware_concurrency();
+    threads = qmin(qmax(threads,1),job.count);
+    workers = new std::thread[threads-1];
+    for (i=0; i<threads-1; ++i)
+        workers[i] = std::thread(refworker,&job);
+    refworker(&job);
+    for (i=0; i<threads-1; ++i)
+        workers[i].join();
+    delete[] workers;
+
+    /* join the blocks */
+
+    to = (unsigned char *)compresseddata;
+    if (!job.failed)
+    {
+        to += refputheader(compresseddata, (unsigned int) sourcesize, sourcesize>0xffffff);
+        rptr = job.from;
+        run = 0;
+        for (i=0; i<job.count; ++i)
+        {
+            blk = &job.blocks[i];
+            run += blk->lead;
+            if (!blk->len)
+                continue;
+            to = refputmatch(to,rptr,run,blk->offset,blk->len);
+            memcpy(to,blk->out,blk->outlen);
+            to += blk->outlen;
+            run = blk->run;
+            rptr = job.from+qmin((i+1)*REFMTBLOCK,sourcesize)-run;
+        }
+        to = refputeof(to,rptr,run);
+    }
+
+    gfree(out);
+    gfree(job.blocks);
+    return((int)(to-(unsigned char *)compresseddata));
+}
 
 /****************************************************************/
-/*  Encode Function                                             */
+/*  Stream Encode Functions                                     */
 /****************************************************************/
 
-int GCALL REF_encode(void *compresseddata, const void *source, int sourcesize, int *opts)
+/* The buffer holds the history a reference can reach, the chunk being
+   parsed and the lookahead its last reference may read.  Once a chunk
+   is parsed everything moves down by a chunk; the chunk size is the
+   tree size of the match finder so its nodes can stay in place. */
+
+#define REFSTREAMHIST   131072
+#define REFSTREAMCHUNK  131072
+#define REFSTREAMLOOK   (REFMAXMATCH+4)
+#define REFSTREAMBUF    (REFSTREAMHIST+REFSTREAMCHUNK+REFSTREAMLOOK)
+#define REFSTREAMOUT    (REFSTREAMBUF+REFSTREAMBUF/64+16)
+
+struct REFENCSTREAM
 {
-    int    maxback=131072;
-    int     quick=0;
-    int    plen;
-    int    hlen;
+    struct MATCHFINDER mf;
+    unsigned char   *buf;       /* history, chunk and lookahead */
+    unsigned char   *out;       /* commands not yet pulled */
+    int             fill;       /* bytes in buf */
+    int             pos;        /* next position to parse */
+    int             rpos;       /* start of the pending literal run */
+    unsigned int    run;        /* pending literals */
+    int             outlen;
+    int             outpos;
+    unsigned int    total;      /* bytes pushed */
+    int             sourcesize; /* size given to begin, -1 if unknown */
+    int             finished;   /* 1 no more input, 2 eof written */
+};
 
+/* parse a chunk, or the rest of the input once it is finished, into
+   the empty out buffer */
 
-    /* simple fb6 header */
+static void refstreamstep(struct REFENCSTREAM *st)
+{
+    unsigned char *rptr = st->buf+st->rpos;
+    unsigned char *to = st->out;
 
-    if (sourcesize>0xffffff)  // 32 bit header required
+    if (st->finished)
     {
-        gputm(compresseddata,   (unsigned int) 0x90fb, 2);
-        gputm((char *)compresseddata+2, (unsigned int) sourcesize, 4);
-        hlen = 6L;
+        to = refparse(&st->mf,st->buf,&st->pos,st->fill-3,st->fill,&rptr,&st->run,to,0,0);
+        st->run += st->fill-st->pos;
+        to = refputeof(to,rptr,st->run);
+        st->finished = 2;
     }
     else
     {
-        gputm(compresseddata,   (unsigned int) 0x10fb, 2);
-        gputm((char *)compresseddata+2, (unsigned int) sourcesize, 3);
-        hlen = 5L;
+        to = refparse(&st->mf,st->buf,&st->pos,st->fill-REFSTREAMLOOK,st->fill,&rptr,&st->run,to,0,0);
+        to = refputliterals(to,&rptr,&st->run);
+
+        memmove(st->buf,st->buf+REFSTREAMCHUNK,st->fill-REFSTREAMCHUNK);
+        MF_shift(&st->mf,REFSTREAMCHUNK);
+        st->fill -= REFSTREAMCHUNK;
+        st->pos -= REFSTREAMCHUNK;
+        rptr -= REFSTREAMCHUNK;
+    }
+    st->rpos = (int)(rptr-st->buf);
+    st->outlen = (int)(to-st->out);
+    st->outpos = 0;
+}
+
+/* sourcesize is the total to be pushed if known, else -1.  A known size
+   goes in the header at the front of the output.  Otherwise the output
+   starts with a 6 byte header to be replaced by REF_stream_encode_header
+   once the stream is finished. */
+
+struct REFENCSTREAM *GCALL REF_stream_encode_begin(int sourcesize)
+{
+    struct REFENCSTREAM *st;
+
+    st = (struct REFENCSTREAM *) galloc(sizeof(struct REFENCSTREAM));
+    if (!st)
+        return(0);
+    memset(st,0,sizeof(struct REFENCSTREAM));
+    st->buf = (unsigned char *) galloc(REFSTREAMBUF);
+    st->out = (unsigned char *) galloc(REFSTREAMOUT);
+    if (!st->buf || !st->out || !MF_init(&st->mf,REFMFMODE,131071,REFMFDEPTH,3,REFMFNICE,REFMAXMATCH,REFSTREAMBUF))
+    {
+        REF_stream_encode_end(st);
+        return(0);
+    }
+    MF_reset(&st->mf,st->buf);
+
+    st->sourcesize = sourcesize;
+    if (sourcesize>=0)
+        st->outlen = refputheader(st->out,(unsigned int) sourcesize,sourcesize>0xffffff);
+    else
+        st->outlen = refputheader(st->out,0,1);
+    return(st);
+}
+
+/* returns the bytes taken, fewer than sourcesize when the output has to
+   be pulled first */
+
+int GCALL REF_stream_encode_push(struct REFENCSTREAM *st, const void *source, int sourcesize)
+{
+    int taken = 0;
+    int n;
+
+    while (taken<sourcesize && !st->finished)
+    {
+        if (st->fill==REFSTREAMBUF)
+        {
+            if (st->outpos<st->outlen)
+                break;
+            refstreamstep(st);
+        }
+        n = qmin(sourcesize-taken,REFSTREAMBUF-st->fill);
+        memcpy(st->buf+st->fill,(const char *)source+taken,n);
+        st->fill += n;
+        taken += n;
+    }
+    st->total += taken;
+    return(taken);
+}
+
+/* no more input; false if it does not add up to the size given to begin */
+
+bool GCALL REF_stream_encode_finish(struct REFENCSTREAM *st)
+{
+    if (!st->finished)
+        st->finished = 1;
+    return(st->sourcesize<0 || (unsigned int) st->sourcesize==st->total);
+}
+
+/* returns the bytes written to compresseddata, 0 once everything is out
+   or until more input is pushed */
+
+int GCALL REF_stream_encode_pull(struct REFENCSTREAM *st, void *compresseddata, int size)
+{
+    int done = 0;
+    int n;
+
+    while (done<size)
+    {
+        if (st->outpos==st->outlen)
+        {
+            if (st->finished==1 || (!st->finished && st->fill==REFSTREAMBUF))
+                refstreamstep(st);
+            else
+                break;
+        }
+        n = qmin(size-done,st->outlen-st->outpos);
+        memcpy((char *)compresseddata+done,st->out+st->outpos,n);
+        st->outpos += n;
+        done += n;
+    }
+    return(done);
+}
+
+/* the header for the total pushed, to write over the start of the
+   output; returns its length */
+
+int GCALL REF_stream_encode_header(struct REFENCSTREAM *st, void *header)
+{
+    if (st->sourcesize>=0)
+        return(refputheader(header,(unsigned int) st->sourcesize,st->sourcesize>0xffffff));
+    return(refputheader(header,st->total,1));
+}
+
+void GCALL REF_stream_encode_end(struct REFENCSTREAM *st)
+{
+    if (st)
+    {
+        MF_free(&st->mf);
+        if (st->out) gfree(st->out);
+        if (st->buf) gfree(st->buf);
+        gfree(st);
+    }
+}
+
+
+/****************************************************************/
+/*  Incremental Encode                                          */
+/****************************************************************/
+
+/* The commands of the last encode are kept with sync points: the input
+   and command offsets after a reference, where no literal is pending.
+   An edited source is parsed again from the last sync point before the
+   first changed byte, with the match finder primed from the 128 KB
+   before it.  Once the new parse is 128 KB past the last changed byte
+   and after a reference ends where one ended before, the rest of the
+   old commands are copied: no reference from there reaches the edit. */
+
+#define REFINCRSTEP     256             /* fewest input bytes between sync points */
+#define REFINCRHIST     131072
+
+struct RefSync
+{
+    int             in;                 /* input after the reference */
+    int             out;                /* command bytes after it */
+};
+
+struct REFINCR
+{
+    unsigned char   *src;               /* the source last encoded */
+    int             size;
+    unsigned char   *cmd;               /* its commands, without the header */
+    int             cmdlen;
+    struct RefSync  *sync;
+    int             nsync;
+    int             depth;
+    int             nice;
+    unsigned int    penalty;
+};
+
+struct REFINCR *GCALL REF_incr_begin(int *opts)
+{
+    struct REFINCR *st;
+
+    st = (struct REFINCR *) galloc(sizeof(struct REFINCR));
+    if (!st)
+        return(0);
+    memset(st,0,sizeof(struct REFINCR));
+    reflevel(opts, &st->depth, &st->nice, &st->penalty);
+    if (opts && !(opts[0]&REF_OPT_SEARCH) && (opts[0]&REF_LEVEL_MASK)==REF_LEVEL_MAX)
+    {
+        st->depth = REFMFDEPTH;
+        st->nice = REFMFNICE;
+    }
+    return(st);
+}
+
+/* encodes source to a valid stream, usually byte-identical to what
+   REF_encode gives, reusing what it can of the last encode; returns the
+   compressed size, 0 if out of memory */
+
+int GCALL REF_incr_encode(struct REFINCR *st, void *compresseddata, const void *source, int sourcesize)
+{
+    const unsigned char *src = (const unsigned char *) source;
+    struct MATCHFINDER mf;
+    struct RefSync *sync;
+    unsigned char *cmd;
+    unsigned char *to;
+    unsigned char *rptr;
+    unsigned int boffset;
+    unsigned int blen;
+    unsigned int run;
+    int nsync;
+    int first;
+    int edge;
+    int tail;
+    int lim;
+    int delta;
+    int shift;
+    int hist;
+    int base;
+    bool insync;
+    int k;
+    int j;
+    int i;
+    int pos;
+    int hlen;
+
+    /* the edit: first changed byte and unchanged tail */
+    first = 0;
+    tail = 0;
+    if (st->src)
+    {
+        lim = qmin(sourcesize,st->size);
+        while (first<lim && src[first]==st->src[first])
+            ++first;
+        while (tail<lim-first && src[sourcesize-1-tail]==st->src[st->size-1-tail])
+            ++tail;
+    }
+    hlen = refputheader(compresseddata,(unsigned int) sourcesize,sourcesize>0xffffff);
+    if (st->src && first==sourcesize && sourcesize==st->size)
+    {
+        memcpy((char *)compresseddata+hlen,st->cmd,st->cmdlen);
+        return(hlen+st->cmdlen);
+    }
+
+    cmd = (unsigned char *) galloc(sourcesize+sourcesize/64+16);
+    sync = (struct RefSync *) galloc((sourcesize/REFINCRSTEP+2)*sizeof(struct RefSync));
+    if (!cmd || !sync)
+    {
+        if (sync) gfree(sync);
+        if (cmd) gfree(cmd);
+        return(0);
+    }
+
+    /* keep the commands before the last sync point ahead of the edit */
+    for (k=st->nsync; k>0 && st->sync[k-1].in>first; --k)
+        ;
+    pos = k ? st->sync[k-1].in : 0;
+    to = cmd;
+    if (k)
+    {
+        memcpy(cmd,st->cmd,st->sync[k-1].out);
+        memcpy(sync,st->sync,k*sizeof(struct RefSync));
+        to += st->sync[k-1].out;
+    }
+    nsync = k;
+
+    hist = qmin(pos,REFINCRHIST);
+    base = pos-hist;
+    if (!MF_init(&mf,REFMFMODE,131071,st->depth,3,st->nice,REFMAXMATCH,sourcesize-base))
+    {
+        gfree(sync);
+        gfree(cmd);
+        return(0);
+    }
+    MF_reset(&mf,src+base);
+    for (i=0; i<hist; ++i)
+        MF_skip(&mf,i,sourcesize-base);
+
+    /* parse until a reference ends where an old one did, far enough
+       past the edit */
+    edge = st->src ? sourcesize-tail+REFINCRHIST : sourcesize;
+    delta = sourcesize-st->size;
+    insync = false;
+    j = k;
+    run = 0;
+    rptr = (unsigned char *) src+pos;
+    while (pos<sourcesize-3 && !insync)
+    {
+        blen = refmatch(&mf,pos-base,sourcesize-4-pos,&boffset,st->penalty);
+        if (!blen)
+        {
+            ++run;
+            ++pos;
+            continue;
+        }
+        to = refputmatch(to,rptr,run,boffset,blen);
+        run = 0;
+        for (i=1; i<(int)blen; ++i)
+            MF_skip(&mf,pos-base+i,sourcesize-4-base);
+        pos += blen;
+        rptr = (unsigned char *) src+pos;
+        if (!nsync || pos>=sync[nsync-1].in+REFINCRSTEP)
+        {
+            sync[nsync].in = pos;
+            sync[nsync].out = (int) (to-cmd);
+            ++nsync;
+        }
+        if (pos>=edge)
+        {
+            while (j<st->nsync && st->sync[j].in<pos-delta)
+                ++j;
+            insync = j<st->nsync && st->sync[j].in==pos-delta;
+        }
+    }
+
+    if (insync)
+    {
+        /* the rest of the commands are the old ones */
+        shift = (int) (to-cmd)-st->sync[j].out;
+        memcpy(to,st->cmd+st->sync[j].out,st->cmdlen-st->sync[j].out);
+        to += st->cmdlen-st->sync[j].out;
+        if (sync[nsync-1].in==pos)
+            ++j;
+        for (; j<st->nsync; ++j)
+        {
+            sync[nsync].in = st->sync[j].in+delta;
+            sync[nsync].out = st->sync[j].out+shift;
+            ++nsync;
+        }
+    }
+    else
+    {
+        run += sourcesize-pos;
+        to = refputeof(to,rptr,run);
+    }
+    MF_free(&mf);
+
+    /* keep this encode for the next */
+    if (st->size!=sourcesize || !st->src)
+    {
+        if (st->src) gfree(st->src);
+        st->src = (unsigned char *) galloc(sourcesize+1);
+    }
+    if (st->cmd) gfree(st->cmd);
+    if (st->sync) gfree(st->sync);
+    st->cmd = cmd;
+    st->cmdlen = (int) (to-cmd);
+    st->sync = sync;
+    st->nsync = nsync;
+    st->size = sourcesize;
+    if (st->src)
+        memcpy(st->src,src,sourcesize);
+
+    memcpy((char *)compresseddata+hlen,cmd,st->cmdlen);
+    return(hlen+st->cmdlen);
+}
+
+void GCALL REF_incr_end(struct REFINCR *st)
+{
+    if (st)
+    {
+        if (st->sync) gfree(st->sync);
+        if (st->cmd) gfree(st->cmd);
+        if (st->src) gfree(st->src);
+        gfree(st);
     }
-    plen = hlen+refcompress((unsigned char *)source, sourcesize, (unsigned char *)compresseddata+hlen, maxback, quick);
-    return(plen);
 }
 
 #endif
@@ -1,3 +1,4 @@
+#include "matchfind.cpp"
 #include "huffdecode.cpp"
 #include "huffencode.cpp"
 #include "refdecode.cpp"
@@ -6,6 +7,7 @@
 #include "btreeencode.cpp"
 #include "jdlz_compression.cpp"
 #include "ea_comp.cpp"
+#include "comp_encode.cpp"
 
 #include <cstring>
 #define _tmain main
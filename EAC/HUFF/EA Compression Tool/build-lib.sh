@@ -10,8 +10,8 @@ NC='\033[0m' # No Color
 echo -e "${GREEN}Building EA Compression shared library...${NC}"
 
 # Set compiler flags
-CXXFLAGS="-fPIC -O3 -Wall -Wextra"
-INCLUDES="-I. -IUNIX -IHUFF -IREFPACK -IBTREE -IJDLZ -ICOMP"
+CXXFLAGS="-fPIC -O3 -Wall -Wextra -pthread"
+INCLUDES="-I. -IUNIX -IHUFF -IREFPACK -IBTREE -IJDLZ -ICOMP -IMATCH"
 LDFLAGS="-shared -Wl,-soname,libea_compression.so.1"
 OUTPUT="libea_compression.so.1.0.0"
 
@@ -17,6 +17,7 @@
 #include "btreecodex.h"
 #include "jdlz_compression.h"
 #include "ea_comp.h"
+#include "comp_encode.h"
 
 // Export symbols for shared library
 #ifdef _WIN32
@@ -152,9 +153,9 @@ EA_EXPORT int ea_decompress(
 
     switch (format) {
         case EA_FORMAT_HUFF: {
-            if (HUFF_is(compressed_data + 16)) {
-                int z_size = compressed_size - 16;
-                result = HUFF_decode(decompressed_data, compressed_data + 16, &z_size);
+            if (compressed_size >= 18 && HUFF_is(compressed_data + 16)) {
+                result = HUFF_decode_fast(decompressed_data, decompressed_size,
+                                          compressed_data + 16, compressed_size - 16);
             } else {
                 return EA_ERROR_INVALID_FORMAT;
             }
@@ -186,14 +187,14 @@ EA_EXPORT int ea_decompress(
         }
 
         case EA_FORMAT_REF: {
-            int z_size = compressed_size;
-            result = REF_decode(decompressed_data, compressed_data, &z_size);
+            result = REF_decode_safe(decompressed_data, decompressed_size,
+                                     compressed_data, compressed_size);
             break;
         }
 
         case EA_FORMAT_BTREE: {
-            int z_size = compressed_size;
-            result = BTREE_decode(decompressed_data, compressed_data, &z_size);
+            result = BTREE_decode_safe(decompressed_data, decompressed_size,
+                                       compressed_data, compressed_size);
             break;
         }
 
@@ -208,6 +209,209 @@ EA_EXPORT int ea_decompress(
     return result;
 }
 
+/**
+ * Get the extra bytes ea_decompress_inplace needs past the decompressed size
+ * @param compressed_data REF or JDLZ compressed data
+ * @param compressed_size Size of compressed data
+ * @return Margin in bytes or negative error code
+ */
+EA_EXPORT int ea_inplace_margin(const unsigned char *compressed_data, int compressed_size)
+{
+    if (!compressed_data) {
+        return EA_ERROR_NULL_POINTER;
+    }
+
+    if (compressed_size < 4) {
+        return EA_ERROR_INVALID_FORMAT;
+    }
+
+    int margin;
+    switch (ea_detect_format(compressed_data, compressed_size)) {
+        case EA_FORMAT_JDLZ: {
+            if (compressed_size < 16) {
+                return EA_ERROR_INVALID_FORMAT;
+            }
+            // the 16-byte header is read before anything is written, but
+            // the buffer must still hold all of it
+            int decompressed_size = ea_get_decompressed_size(compressed_data, compressed_size);
+            margin = JDLZ_Inplace_Margin(compressed_data + 16, compressed_size - 16, decompressed_size);
+            if (margin >= 0 && margin < compressed_size - decompressed_size) {
+                margin = compressed_size - decompressed_size;
+            }
+            break;
+        }
+
+        case EA_FORMAT_REF:
+            margin = REF_inplace_margin(compressed_data, compressed_size);
+            break;
+
+        default:
+            return EA_ERROR_INVALID_FORMAT;
+    }
+
+    if (margin < 0) {
+        return EA_ERROR_DECOMPRESS;
+    }
+
+    return margin;
+}
+
+/**
+ * Decompress REF or JDLZ data over itself
+ * @param buffer Buffer whose last compressed_size bytes hold the compressed data
+ * @param buffer_size At least the decompressed size plus ea_inplace_margin
+ * @param compressed_size Size of compressed data
+ * @return Number of bytes decompressed, at the start of buffer, or negative error code
+ */
+EA_EXPORT int ea_decompress_inplace(
+    unsigned char *buffer,
+    int buffer_size,
+    int compressed_size)
+{
+    if (!buffer) {
+        return EA_ERROR_NULL_POINTER;
+    }
+
+    if (compressed_size < 4 || compressed_size > buffer_size) {
+        return EA_ERROR_INVALID_FORMAT;
+    }
+
+    unsigned char *compressed_data = buffer + buffer_size - compressed_size;
+    int expected_size = ea_get_decompressed_size(compressed_data, compressed_size);
+    int result;
+
+    if (expected_size > buffer_size) {
+        return EA_ERROR_BUFFER_TOO_SMALL;
+    }
+
+    switch (ea_detect_format(compressed_data, compressed_size)) {
+        case EA_FORMAT_JDLZ:
+            if (compressed_size < 16) {
+                return EA_ERROR_INVALID_FORMAT;
+            }
+            result = JDLZ_Decompress_Inplace(buffer, buffer_size, compressed_size - 16, expected_size);
+            break;
+
+        case EA_FORMAT_REF:
+            result = REF_decode_inplace(buffer, buffer_size, compressed_size);
+            break;
+
+        default:
+            return EA_ERROR_INVALID_FORMAT;
+    }
+
+    if (result < 0 || result != expected_size) {
+        return EA_ERROR_DECOMPRESS;
+    }
+
+    return result;
+}
+
+/**
+ * Get the buffer size ea_decompress_huff_index needs for its sync point index
+ * @param decompressed_size Size of the decompressed data
+ * @param interval Bytes of output between sync points (0 for the default of 64KB)
+ * @return Index size in bytes
+ */
+EA_EXPORT int ea_huff_index_size(int decompressed_size, int interval)
+{
+    return HUFF_index_size(decompressed_size, interval);
+}
+
+/**
+ * Decompress HUFF data and record a sync point index for ea_decompress_huff_mt
+ * @param compressed_data HUFF compressed data (including 16-byte header)
+ * @param compressed_size Size of compressed data
+ * @param decompressed_data Output buffer
+ * @param decompressed_size Size of output buffer
+ * @param index Index buffer (at least ea_huff_index_size bytes)
+ * @param index_size In: size of index buffer, out: bytes of index written
+ * @param interval Bytes of output between sync points (0 for the default of 64KB)
+ * @return Number of bytes decompressed or negative error code
+ */
+EA_EXPORT int ea_decompress_huff_index(
+    const unsigned char *compressed_data,
+    int compressed_size,
+    unsigned char *decompressed_data,
+    int decompressed_size,
+    unsigned char *index,
+    int *index_size,
+    int interval)
+{
+    if (!compressed_data || !decompressed_data || !index || !index_size) {
+        return EA_ERROR_NULL_POINTER;
+    }
+
+    if (compressed_size < 18 || !HUFF_is(compressed_data + 16)) {
+        return EA_ERROR_INVALID_FORMAT;
+    }
+
+    int expected_size = HUFF_size(compressed_data + 16);
+
+    if (expected_size > decompressed_size) {
+        return EA_ERROR_BUFFER_TOO_SMALL;
+    }
+
+    if (*index_size < HUFF_index_size(expected_size, interval)) {
+        return EA_ERROR_BUFFER_TOO_SMALL;
+    }
+
+    int result = HUFF_decode_index(decompressed_data, decompressed_size,
+                                   compressed_data + 16, compressed_size - 16,
+                                   index, index_size, interval);
+
+    if (result < 0 || result != expected_size) {
+        return EA_ERROR_DECOMPRESS;
+    }
+
+    return result;
+}
+
+/**
+ * Decompress HUFF data on several threads using an index from ea_decompress_huff_index
+ * @param compressed_data HUFF compressed data (including 16-byte header)
+ * @param compressed_size Size of compressed data
+ * @param decompressed_data Output buffer
+ * @param decompressed_size Size of output buffer
+ * @param index Sync point index recorded for this data
+ * @param index_size Size of index
+ * @param threads Worker threads (0 for one per core)
+ * @return Number of bytes decompressed or negative error code
+ */
+EA_EXPORT int ea_decompress_huff_mt(
+    const unsigned char *compressed_data,
+    int compressed_size,
+    unsigned char *decompressed_data,
+    int decompressed_size,
+    const unsigned char *index,
+    int index_size,
+    int threads)
+{
+    if (!compressed_data || !decompressed_data || !index) {
+        return EA_ERROR_NULL_POINTER;
+    }
+
+    if (compressed_size < 18 || !HUFF_is(compressed_data + 16)) {
+        return EA_ERROR_INVALID_FORMAT;
+    }
+
+    int expected_size = HUFF_size(compressed_data + 16);
+
+    if (expected_size > decompressed_size) {
+        return EA_ERROR_BUFFER_TOO_SMALL;
+    }
+
+    int result = HUFF_decode_mt(decompressed_data, decompressed_size,
+                                compressed_data + 16, compressed_size - 16,
+                                index, index_size, threads);
+
+    if (result < 0 || result != expected_size) {
+        return EA_ERROR_DECOMPRESS;
+    }
+
+    return result;
+}
+
 /**
  * Compress data with HUFF format
  * @param source Source data to compress
@@ -259,6 +463,111 @@ EA_EXPORT int ea_compress_huff(
     return compressed_size + 16;
 }
 
+/**
+ * Compress data with HUFF format, split in 4 streams that decode faster
+ * @param source Source data to compress
+ * @param source_size Size of source data
+ * @param dest Destination buffer (should be at least source_size * 2 + 64)
+ * @param dest_size Size of destination buffer
+ * @param huff_type HUFF compression type (0, 1, or 2), written as 0x38fb, 0x3afb or 0x3cfb
+ * @return Compressed size (including 16-byte header) or negative error code
+ */
+EA_EXPORT int ea_compress_huff_streams(
+    const unsigned char *source,
+    int source_size,
+    unsigned char *dest,
+    int dest_size,
+    int huff_type)
+{
+    if (!source || !dest) {
+        return EA_ERROR_NULL_POINTER;
+    }
+
+    if (dest_size < source_size * 2 + 64) {
+        return EA_ERROR_BUFFER_TOO_SMALL;
+    }
+
+    if (huff_type < 0 || huff_type > 2) {
+        return EA_ERROR_INVALID_FORMAT;
+    }
+
+    int opt = huff_type | HUFF_OPT_4STREAMS;
+    int compressed_size = HUFF_encode(dest + 16, source, source_size, &opt);
+    
+    if (compressed_size <= 0) {
+        return EA_ERROR_COMPRESS;
+    }
+
+    // Create HUFF header
+    memset(dest, 0, 16);
+    memcpy(dest, "HUFF", 4);
+    dest[4] = 0x01;
+    dest[5] = 0x10;
+    dest[8] = source_size;
+    dest[9] = source_size >> 8;
+    dest[10] = source_size >> 16;
+    dest[11] = source_size >> 24;
+    dest[12] = compressed_size;
+    dest[13] = compressed_size >> 8;
+    dest[14] = compressed_size >> 16;
+    dest[15] = compressed_size >> 24;
+
+    return compressed_size + 16;
+}
+
+/**
+ * Compress data with HUFF format, packing the codes on several threads
+ * @param source Source data to compress
+ * @param source_size Size of source data
+ * @param dest Destination buffer (should be at least source_size * 2 + 16)
+ * @param dest_size Size of destination buffer
+ * @param huff_type HUFF compression type (0, 1, or 2)
+ * @param threads Number of threads, 0 for one per core. The output is the same for any number
+ * @return Compressed size (including 16-byte header) or negative error code
+ */
+EA_EXPORT int ea_compress_huff_mt(
+    const unsigned char *source,
+    int source_size,
+    unsigned char *dest,
+    int dest_size,
+    int huff_type,
+    int threads)
+{
+    if (!source || !dest) {
+        return EA_ERROR_NULL_POINTER;
+    }
+
+    if (dest_size < source_size * 2 + 16) {
+        return EA_ERROR_BUFFER_TOO_SMALL;
+    }
+
+    if (huff_type < 0 || huff_type > 2) {
+        return EA_ERROR_INVALID_FORMAT;
+    }
+
+    int compressed_size = HUFF_encode_mt(dest + 16, source, source_size, &huff_type, threads);
+    
+    if (compressed_size <= 0) {
+        return EA_ERROR_COMPRESS;
+    }
+
+    // Create HUFF header
+    memset(dest, 0, 16);
+    memcpy(dest, "HUFF", 4);
+    dest[4] = 0x01;
+    dest[5] = 0x10;
+    dest[8] = source_size;
+    dest[9] = source_size >> 8;
+    dest[10] = source_size >> 16;
+    dest[11] = source_size >> 24;
+    dest[12] = compressed_size;
+    dest[13] = compressed_size >> 8;
+    dest[14] = compressed_size >> 16;
+    dest[15] = compressed_size >> 24;
+
+    return compressed_size + 16;
+}
+
 /**
  * Compress data with JDLZ format
  * @param source Source data to compress
@@ -291,18 +600,20 @@ EA_EXPORT int ea_compress_jdlz(
 }
 
 /**
- * Compress data with REF format
+ * Compress data with JDLZ format at a given level
  * @param source Source data to compress
  * @param source_size Size of source data
  * @param dest Destination buffer (should be at least source_size * 2)
  * @param dest_size Size of destination buffer
+ * @param level 0 greedy parse, 1 optimal parse (best ratio, slower)
  * @return Compressed size or negative error code
  */
-EA_EXPORT int ea_compress_ref(
+EA_EXPORT int ea_compress_jdlz_level(
     const unsigned char *source,
     int source_size,
     unsigned char *dest,
-    int dest_size)
+    int dest_size,
+    int level)
 {
     if (!source || !dest) {
         return EA_ERROR_NULL_POINTER;
@@ -312,9 +623,14 @@ EA_EXPORT int ea_compress_ref(
         return EA_ERROR_BUFFER_TOO_SMALL;
     }
 
-    int opts = 0;
-    int compressed_size = REF_encode(dest, source, source_size, &opts);
-    
+    if (level < 0 || level > 1) {
+        return EA_ERROR_INVALID_FORMAT;
+    }
+
+    int compressed_size = level == 1 ?
+        JDLZ_Compress_Opt((unsigned char*)source, source_size, dest) :
+        JDLZ_Compress((unsigned char*)source, source_size, dest);
+
     if (compressed_size <= 0) {
         return EA_ERROR_COMPRESS;
     }
@@ -323,18 +639,20 @@ EA_EXPORT int ea_compress_ref(
 }
 
 /**
- * Compress data with BTREE format
+ * Compress data with JDLZ format on several threads
  * @param source Source data to compress
  * @param source_size Size of source data
  * @param dest Destination buffer (should be at least source_size * 2)
  * @param dest_size Size of destination buffer
+ * @param threads Number of threads, 0 for one per core. The output is the same for any number
  * @return Compressed size or negative error code
  */
-EA_EXPORT int ea_compress_btree(
+EA_EXPORT int ea_compress_jdlz_mt(
     const unsigned char *source,
     int source_size,
     unsigned char *dest,
-    int dest_size)
+    int dest_size,
+    int threads)
 {
     if (!source || !dest) {
         return EA_ERROR_NULL_POINTER;
@@ -344,9 +662,8 @@ EA_EXPORT int ea_compress_btree(
         return EA_ERROR_BUFFER_TOO_SMALL;
     }
 
-    int opts = 0;
-    int compressed_size = BTREE_encode(dest, source, source_size, &opts);
-    
+    int compressed_size = JDLZ_Compress_MT((unsigned char*)source, source_size, dest, threads);
+
     if (compressed_size <= 0) {
         return EA_ERROR_COMPRESS;
     }
@@ -354,6 +671,407 @@ EA_EXPORT int ea_compress_btree(
     return compressed_size;
 }
 
+/**
+ * Compress data with JDLZ format, favouring decode speed
+ * @param source Source data to compress
+ * @param source_size Size of source data
+ * @param dest Destination buffer (should be at least source_size * 2)
+ * @param dest_size Size of destination buffer
+ * @param penalty Cost in bytes added to every match, 0 for the smallest output
+ * @return Compressed size or negative error code
+ */
+EA_EXPORT int ea_compress_jdlz_speed(
+    const unsigned char *source,
+    int source_size,
+    unsigned char *dest,
+    int dest_size,
+    int penalty)
+{
+    if (!source || !dest) {
+        return EA_ERROR_NULL_POINTER;
+    }
+
+    if (dest_size < source_size * 2) {
+        return EA_ERROR_BUFFER_TOO_SMALL;
+    }
+
+    int compressed_size = JDLZ_Compress((unsigned char*)source, source_size, dest, penalty);
+
+    if (compressed_size <= 0) {
+        return EA_ERROR_COMPRESS;
+    }
+
+    return compressed_size;
+}
+
+/**
+ * Compress data with REF format
+ * @param source Source data to compress
+ * @param source_size Size of source data
+ * @param dest Destination buffer (should be at least source_size * 2)
+ * @param dest_size Size of destination buffer
+ * @return Compressed size or negative error code
+ */
+EA_EXPORT int ea_compress_ref(
+    const unsigned char *source,
+    int source_size,
+    unsigned char *dest,
+    int dest_size)
+{
+    if (!source || !dest) {
+        return EA_ERROR_NULL_POINTER;
+    }
+
+    if (dest_size < source_size * 2) {
+        return EA_ERROR_BUFFER_TOO_SMALL;
+    }
+
+    int opts = 0;
+    int compressed_size = REF_encode(dest, source, source_size, &opts);
+    
+    if (compressed_size <= 0) {
+        return EA_ERROR_COMPRESS;
+    }
+
+    return compressed_size;
+}
+
+/**
+ * Compress data with REF format at a given level
+ * @param source Source data to compress
+ * @param source_size Size of source data
+ * @param dest Destination buffer (should be at least source_size * 2)
+ * @param dest_size Size of destination buffer
+ * @param level REF_LEVEL_NORMAL (0) greedy, REF_LEVEL_MAX (1) optimal parse
+ *              or REF_LEVEL_FAST (2) single hash probe
+ * @return Compressed size or negative error code
+ */
+EA_EXPORT int ea_compress_ref_level(
+    const unsigned char *source,
+    int source_size,
+    unsigned char *dest,
+    int dest_size,
+    int level)
+{
+    if (!source || !dest) {
+        return EA_ERROR_NULL_POINTER;
+    }
+
+    if (dest_size < source_size * 2) {
+        return EA_ERROR_BUFFER_TOO_SMALL;
+    }
+
+    if (level < REF_LEVEL_NORMAL || level > REF_LEVEL_FAST) {
+        return EA_ERROR_INVALID_FORMAT;
+    }
+
+    int compressed_size = REF_encode(dest, source, source_size, &level);
+    
+    if (compressed_size <= 0) {
+        return EA_ERROR_COMPRESS;
+    }
+
+    return compressed_size;
+}
+
+/**
+ * Compress data with REF format at a given level, favouring decode speed
+ * @param source Source data to compress
+ * @param source_size Size of source data
+ * @param dest Destination buffer (should be at least source_size * 2)
+ * @param dest_size Size of destination buffer
+ * @param level REF_LEVEL_NORMAL (0), REF_LEVEL_MAX (1) or REF_LEVEL_FAST (2)
+ * @param penalty Cost in bytes added to every command (REF_OPT_DECODE),
+ *                0 for the smallest output
+ * @return Compressed size or negative error code
+ */
+EA_EXPORT int ea_compress_ref_speed(
+    const unsigned char *source,
+    int source_size,
+    unsigned char *dest,
+    int dest_size,
+    int level,
+    int penalty)
+{
+    if (!source || !dest) {
+        return EA_ERROR_NULL_POINTER;
+    }
+
+    if (dest_size < source_size * 2) {
+        return EA_ERROR_BUFFER_TOO_SMALL;
+    }
+
+    if (level < REF_LEVEL_NORMAL || level > REF_LEVEL_FAST) {
+        return EA_ERROR_INVALID_FORMAT;
+    }
+
+    int opts[4] = { level | REF_OPT_DECODE, 0, 0, penalty };
+    int compressed_size = REF_encode(dest, source, source_size, opts);
+
+    if (compressed_size <= 0) {
+        return EA_ERROR_COMPRESS;
+    }
+
+    return compressed_size;
+}
+
+/**
+ * Compress data with REF format on several threads
+ * @param source Source data to compress
+ * @param source_size Size of source data
+ * @param dest Destination buffer (should be at least source_size * 2)
+ * @param dest_size Size of destination buffer
+ * @param threads Number of threads, 0 for one per core. The output is the same for any number
+ * @return Compressed size or negative error code
+ */
+EA_EXPORT int ea_compress_ref_mt(
+    const unsigned char *source,
+    int source_size,
+    unsigned char *dest,
+    int dest_size,
+    int threads)
+{
+    if (!source || !dest) {
+        return EA_ERROR_NULL_POINTER;
+    }
+
+    if (dest_size < source_size * 2) {
+        return EA_ERROR_BUFFER_TOO_SMALL;
+    }
+
+    int opts = REF_LEVEL_NORMAL;
+    int compressed_size = REF_encode_mt(dest, source, source_size, &opts, threads);
+    
+    if (compressed_size <= 0) {
+        return EA_ERROR_COMPRESS;
+    }
+
+    return compressed_size;
+}
+
+/**
+ * Compress data with REF format, using a dictionary as history
+ * @param source Source data to compress
+ * @param source_size Size of source data
+ * @param dest Destination buffer (should be at least source_size * 2)
+ * @param dest_size Size of destination buffer
+ * @param dict Dictionary, its last 128 KB are used (see REF_train_dict)
+ * @param dict_size Size of the dictionary
+ * @return Compressed size or negative error code
+ */
+EA_EXPORT int ea_compress_ref_dict(
+    const unsigned char *source,
+    int source_size,
+    unsigned char *dest,
+    int dest_size,
+    const unsigned char *dict,
+    int dict_size)
+{
+    if (!source || !dest || (!dict && dict_size > 0)) {
+        return EA_ERROR_NULL_POINTER;
+    }
+
+    if (dest_size < source_size * 2) {
+        return EA_ERROR_BUFFER_TOO_SMALL;
+    }
+
+    int opts = REF_LEVEL_NORMAL;
+    int compressed_size = REF_encode_dict(dest, source, source_size, dict, dict_size, &opts);
+    
+    if (compressed_size <= 0) {
+        return EA_ERROR_COMPRESS;
+    }
+
+    return compressed_size;
+}
+
+/**
+ * Decompress REF data compressed with a dictionary
+ * @param compressed_data Compressed data
+ * @param compressed_size Size of compressed data
+ * @param decompressed_data Output buffer
+ * @param decompressed_size Size of output buffer
+ * @param dict The dictionary the data was compressed with
+ * @param dict_size Size of the dictionary
+ * @return Decompressed size or negative error code
+ */
+EA_EXPORT int ea_decompress_ref_dict(
+    const unsigned char *compressed_data,
+    int compressed_size,
+    unsigned char *decompressed_data,
+    int decompressed_size,
+    const unsigned char *dict,
+    int dict_size)
+{
+    if (!compressed_data || !decompressed_data || (!dict && dict_size > 0)) {
+        return EA_ERROR_NULL_POINTER;
+    }
+
+    if (compressed_size < 5 || !REF_is(compressed_data)) {
+        return EA_ERROR_INVALID_FORMAT;
+    }
+
+    if (REF_size(compressed_data) > decompressed_size) {
+        return EA_ERROR_BUFFER_TOO_SMALL;
+    }
+
+    int result = REF_decode_dict(decompressed_data, decompressed_size,
+                                 compressed_data, compressed_size, dict, dict_size);
+    if (result < 0) {
+        return EA_ERROR_DECOMPRESS;
+    }
+
+    return result;
+}
+
+/**
+ * Make a REF patch that rebuilds source from a previous version of it
+ * @param source New version of the data
+ * @param source_size Size of source data
+ * @param dest Destination buffer (should be at least source_size * 2 + 64)
+ * @param dest_size Size of destination buffer
+ * @param old Previous version of the data
+ * @param old_size Size of the previous version
+ * @return Patch size or negative error code
+ */
+EA_EXPORT int ea_compress_ref_patch(
+    const unsigned char *source,
+    int source_size,
+    unsigned char *dest,
+    int dest_size,
+    const unsigned char *old,
+    int old_size)
+{
+    if (!source || !dest || (!old && old_size > 0)) {
+        return EA_ERROR_NULL_POINTER;
+    }
+
+    if (dest_size < source_size * 2 + 64) {
+        return EA_ERROR_BUFFER_TOO_SMALL;
+    }
+
+    int opts = REF_LEVEL_NORMAL;
+    int patch_size = REF_encode_patch(dest, source, source_size, old, old_size, &opts);
+
+    if (patch_size <= 0) {
+        return EA_ERROR_COMPRESS;
+    }
+
+    return patch_size;
+}
+
+/**
+ * Rebuild data from the previous version and a REF patch
+ * @param patch Patch from ea_compress_ref_patch
+ * @param patch_size Size of the patch
+ * @param decompressed_data Output buffer
+ * @param decompressed_size Size of output buffer
+ * @param old The previous version the patch was made against
+ * @param old_size Size of the previous version
+ * @return Rebuilt size or negative error code
+ */
+EA_EXPORT int ea_decompress_ref_patch(
+    const unsigned char *patch,
+    int patch_size,
+    unsigned char *decompressed_data,
+    int decompressed_size,
+    const unsigned char *old,
+    int old_size)
+{
+    if (!patch || !decompressed_data || (!old && old_size > 0)) {
+        return EA_ERROR_NULL_POINTER;
+    }
+
+    if (patch_size < 16 || REF_patch_size(patch) < 0) {
+        return EA_ERROR_INVALID_FORMAT;
+    }
+
+    if (REF_patch_size(patch) > decompressed_size) {
+        return EA_ERROR_BUFFER_TOO_SMALL;
+    }
+
+    int result = REF_decode_patch(decompressed_data, decompressed_size,
+                                  patch, patch_size, old, old_size);
+    if (result < 0) {
+        return EA_ERROR_DECOMPRESS;
+    }
+
+    return result;
+}
+
+/**
+ * Compress data with BTREE format
+ * @param source Source data to compress
+ * @param source_size Size of source data
+ * @param dest Destination buffer (should be at least source_size * 2)
+ * @param dest_size Size of destination buffer
+ * @return Compressed size or negative error code
+ */
+EA_EXPORT int ea_compress_btree(
+    const unsigned char *source,
+    int source_size,
+    unsigned char *dest,
+    int dest_size)
+{
+    if (!source || !dest) {
+        return EA_ERROR_NULL_POINTER;
+    }
+
+    if (dest_size < source_size * 2) {
+        return EA_ERROR_BUFFER_TOO_SMALL;
+    }
+
+    int opts = 0;
+    int compressed_size = BTREE_encode(dest, source, source_size, &opts);
+    
+    if (compressed_size <= 0) {
+        return EA_ERROR_COMPRESS;
+    }
+
+    return compressed_size;
+}
+
+/**
+ * Compress data with COMP format
+ * @param source Source data to compress
+ * @param source_size Size of source data
+ * @param dest Destination buffer (should be at least source_size * 2 + 16)
+ * @param dest_size Size of destination buffer
+ * @param level COMP_LEVEL_NORMAL (0) greedy or COMP_LEVEL_MAX (1) optimal parse
+ * @return Compressed size (including 16-byte header) or negative error code
+ */
+EA_EXPORT int ea_compress_comp(
+    const unsigned char *source,
+    int source_size,
+    unsigned char *dest,
+    int dest_size,
+    int level)
+{
+    if (!source || !dest) {
+        return EA_ERROR_NULL_POINTER;
+    }
+
+    if (dest_size < source_size * 2 + 16) {
+        return EA_ERROR_BUFFER_TOO_SMALL;
+    }
+
+    if (level < COMP_LEVEL_NORMAL || level > COMP_LEVEL_MAX) {
+        return EA_ERROR_INVALID_FORMAT;
+    }
+
+    COMP_Encoder encoder;
+    int compressed_size = encoder.COMP_encode(source, source_size, dest + 16, level);
+    
+    if (compressed_size <= 0) {
+        return EA_ERROR_COMPRESS;
+    }
+
+    // Create COMP header
+    encoder.COMP_createHeader(dest, source_size, compressed_size);
+
+    return compressed_size + 16;
+}
+
 /**
  * Get version string
  * @return Version string
@@ -65,6 +65,74 @@ EA_EXPORT int ea_decompress(
     unsigned char *decompressed_data,
     int decompressed_size);
 
+/**
+ * Get the extra bytes ea_decompress_inplace needs past the decompressed size
+ * @param compressed_data REF or JDLZ compressed data
+ * @param compressed_size Size of compressed data
+ * @return Margin in bytes or negative error code
+ */
+EA_EXPORT int ea_inplace_margin(const unsigned char *compressed_data, int compressed_size);
+
+/**
+ * Decompress REF or JDLZ data over itself
+ * @param buffer Buffer whose last compressed_size bytes hold the compressed data
+ * @param buffer_size At least the decompressed size plus ea_inplace_margin
+ * @param compressed_size Size of compressed data
+ * @return Number of bytes decompressed, at the start of buffer, or negative error code
+ */
+EA_EXPORT int ea_decompress_inplace(
+    unsigned char *buffer,
+    int buffer_size,
+    int compressed_size);
+
+/**
+ * Get the buffer size ea_decompress_huff_index needs for its sync point index
+ * @param decompressed_size Size of the decompressed data
+ * @param interval Bytes of output between sync points (0 for the default of 64KB)
+ * @return Index size in bytes
+ */
+EA_EXPORT int ea_huff_index_size(int decompressed_size, int interval);
+
+/**
+ * Decompress HUFF data and record a sync point index for ea_decompress_huff_mt
+ * @param compressed_data HUFF compressed data (including 16-byte header)
+ * @param compressed_size Size of compressed data
+ * @param decompressed_data Output buffer
+ * @param decompressed_size Size of output buffer
+ * @param index Index buffer (at least ea_huff_index_size bytes)
+ * @param index_size In: size of index buffer, out: bytes of index written
+ * @param interval Bytes of output between sync points (0 for the default of 64KB)
+ * @return Number of bytes decompressed or negative error code
+ */
+EA_EXPORT int ea_decompress_huff_index(
+    const unsigned char *compressed_data,
+    int compressed_size,
+    unsigned char *decompressed_data,
+    int decompressed_size,
+    unsigned char *index,
+    int *index_size,
+    int interval);
+
+/**
+ * Decompress HUFF data on several threads using an index from ea_decompress_huff_index
+ * @param compressed_data HUFF compressed data (including 16-byte header)
+ * @param compressed_size Size of compressed data
+ * @param decompressed_data Output buffer
+ * @param decompressed_size Size of output buffer
+ * @param index Sync point index recorded for this data
+ * @param index_size Size of index
+ * @param threads Worker threads (0 for one per core)
+ * @return Number of bytes decompressed or negative error code
+ */
+EA_EXPORT int ea_decompress_huff_mt(
+    const unsigned char *compressed_data,
+    int compressed_size,
+    unsigned char *decompressed_data,
+    int decompressed_size,
+    const unsigned char *index,
+    int index_size,
+    int threads);
+
 /**
  * Compress data with HUFF format
  * @param source Source data to compress
@@ -81,6 +149,40 @@ EA_EXPORT int ea_compress_huff(
     int dest_size,
     int huff_type);
 
+/**
+ * Compress data with HUFF format, split in 4 streams that decode faster
+ * @param source Source data to compress
+ * @param source_size Size of source data
+ * @param dest Destination buffer (should be at least source_size * 2 + 64)
+ * @param dest_size Size of destination buffer
+ * @param huff_type HUFF compression type (0, 1, or 2), written as 0x38fb, 0x3afb or 0x3cfb
+ * @return Compressed size (including 16-byte header) or negative error code
+ */
+EA_EXPORT int ea_compress_huff_streams(
+    const unsigned char *source,
+    int source_size,
+    unsigned char *dest,
+    int dest_size,
+    int huff_type);
+
+/**
+ * Compress data with HUFF format, packing the codes on several threads
+ * @param source Source data to compress
+ * @param source_size Size of source data
+ * @param dest Destination buffer (should be at least source_size * 2 + 16)
+ * @param dest_size Size of destination buffer
+ * @param huff_type HUFF compression type (0, 1, or 2)
+ * @param threads Number of threads, 0 for one per core. The output is the same for any number
+ * @return Compressed size (including 16-byte header) or negative error code
+ */
+EA_EXPORT int ea_compress_huff_mt(
+    const unsigned char *source,
+    int source_size,
+    unsigned char *dest,
+    int dest_size,
+    int huff_type,
+    int threads);
+
 /**
  * Compress data with JDLZ format
  * @param source Source data to compress
@@ -95,6 +197,54 @@ EA_EXPORT int ea_compress_jdlz(
     unsigned char *dest,
     int dest_size);
 
+/**
+ * Compress data with JDLZ format at a given level
+ * @param source Source data to compress
+ * @param source_size Size of source data
+ * @param dest Destination buffer (should be at least source_size * 2)
+ * @param dest_size Size of destination buffer
+ * @param level 0 greedy parse, 1 optimal parse (best ratio, slower)
+ * @return Compressed size or negative error code
+ */
+EA_EXPORT int ea_compress_jdlz_level(
+    const unsigned char *source,
+    int source_size,
+    unsigned char *dest,
+    int dest_size,
+    int level);
+
+/**
+ * Compress data with JDLZ format on several threads
+ * @param source Source data to compress
+ * @param source_size Size of source data
+ * @param dest Destination buffer (should be at least source_size * 2)
+ * @param dest_size Size of destination buffer
+ * @param threads Number of threads, 0 for one per core. The output is the same for any number
+ * @return Compressed size or negative error code
+ */
+EA_EXPORT int ea_compress_jdlz_mt(
+    const unsigned char *source,
+    int source_size,
+    unsigned char *dest,
+    int dest_size,
+    int threads);
+
+/**
+ * Compress data with JDLZ format, favouring decode speed
+ * @param source Source data to compress
+ * @param source_size Size of source data
+ * @param dest Destination buffer (should be at least source_size * 2)
+ * @param dest_size Size of destination buffer
+ * @param penalty Cost in bytes added to every match, 0 for the smallest output
+ * @return Compressed size or negative error code
+ */
+EA_EXPORT int ea_compress_jdlz_speed(
+    const unsigned char *source,
+    int source_size,
+    unsigned char *dest,
+    int dest_size,
+    int penalty);
+
 /**
  * Compress data with REF format
  * @param source Source data to compress
@@ -109,6 +259,130 @@ EA_EXPORT int ea_compress_ref(
     unsigned char *dest,
     int dest_size);
 
+/**
+ * Compress data with REF format at a given level
+ * @param source Source data to compress
+ * @param source_size Size of source data
+ * @param dest Destination buffer (should be at least source_size * 2)
+ * @param dest_size Size of destination buffer
+ * @param level REF_LEVEL_NORMAL (0) greedy, REF_LEVEL_MAX (1) optimal parse
+ *              or REF_LEVEL_FAST (2) single hash probe
+ * @return Compressed size or negative error code
+ */
+EA_EXPORT int ea_compress_ref_level(
+    const unsigned char *source,
+    int source_size,
+    unsigned char *dest,
+    int dest_size,
+    int level);
+
+/**
+ * Compress data with REF format at a given level, favouring decode speed
+ * @param source Source data to compress
+ * @param source_size Size of source data
+ * @param dest Destination buffer (should be at least source_size * 2)
+ * @param dest_size Size of destination buffer
+ * @param level REF_LEVEL_NORMAL (0), REF_LEVEL_MAX (1) or REF_LEVEL_FAST (2)
+ * @param penalty Cost in bytes added to every command (REF_OPT_DECODE),
+ *                0 for the smallest output
+ * @return Compressed size or negative error code
+ */
+EA_EXPORT int ea_compress_ref_speed(
+    const unsigned char *source,
+    int source_size,
+    unsigned char *dest,
+    int dest_size,
+    int level,
+    int penalty);
+
+/**
+ * Compress data with REF format on several threads
+ * @param source Source data to compress
+ * @param source_size Size of source data
+ * @param dest Destination buffer (should be at least source_size * 2)
+ * @param dest_size Size of destination buffer
+ * @param threads Number of threads, 0 for one per core. The output is the same for any number
+ * @return Compressed size or negative error code
+ */
+EA_EXPORT int ea_compress_ref_mt(
+    const unsigned char *source,
+    int source_size,
+    unsigned char *dest,
+    int dest_size,
+    int threads);
+
+/**
+ * Compress data with REF format, using a dictionary as history
+ * @param source Source data to compress
+ * @param source_size Size of source data
+ * @param dest Destination buffer (should be at least source_size * 2)
+ * @param dest_size Size of destination buffer
+ * @param dict Dictionary, its last 128 KB are used (see REF_train_dict)
+ * @param dict_size Size of the dictionary
+ * @return Compressed size or negative error code
+ */
+EA_EXPORT int ea_compress_ref_dict(
+    const unsigned char *source,
+    int source_size,
+    unsigned char *dest,
+    int dest_size,
+    const unsigned char *dict,
+    int dict_size);
+
+/**
+ * Decompress REF data compressed with a dictionary
+ * @param compressed_data Compressed data
+ * @param compressed_size Size of compressed data
+ * @param decompressed_data Output buffer
+ * @param decompressed_size Size of output buffer
+ * @param dict The dictionary the data was compressed with
+ * @param dict_size Size of the dictionary
+ * @return Decompressed size or negative error code
+ */
+EA_EXPORT int ea_decompress_ref_dict(
+    const unsigned char *compressed_data,
+    int compressed_size,
+    unsigned char *decompressed_data,
+    int decompressed_size,
+    const unsigned char *dict,
+    int dict_size);
+
+/**
+ * Make a REF patch that rebuilds source from a previous version of it
+ * @param source New version of the data
+ * @param source_size Size of source data
+ * @param dest Destination buffer (should be at least source_size * 2 + 64)
+ * @param dest_size Size of destination buffer
+ * @param old Previous version of the data
+ * @param old_size Size of the previous version
+ * @return Patch size or negative error code
+ */
+EA_EXPORT int ea_compress_ref_patch(
+    const unsigned char *source,
+    int source_size,
+    unsigned char *dest,
+    int dest_size,
+    const unsigned char *old,
+    int old_size);
+
+/**
+ * Rebuild data from the previous version and a REF patch
+ * @param patch Patch from ea_compress_ref_patch
+ * @param patch_size Size of the patch
+ * @param decompressed_data Output buffer
+ * @param decompressed_size Size of output buffer
+ * @param old The previous version the patch was made against
+ * @param old_size Size of the previous version
+ * @return Rebuilt size or negative error code
+ */
+EA_EXPORT int ea_decompress_ref_patch(
+    const unsigned char *patch,
+    int patch_size,
+    unsigned char *decompressed_data,
+    int decompressed_size,
+    const unsigned char *old,
+    int old_size);
+
 /**
  * Compress data with BTREE format
  * @param source Source data to compress
@@ -123,6 +397,22 @@ EA_EXPORT int ea_compress_btree(
     unsigned char *dest,
     int dest_size);
 
+/**
+ * Compress data with COMP format
+ * @param source Source data to compress
+ * @param source_size Size of source data
+ * @param dest Destination buffer (should be at least source_size * 2 + 16)
+ * @param dest_size Size of destination buffer
+ * @param level COMP_LEVEL_NORMAL (0) greedy or COMP_LEVEL_MAX (1) optimal parse
+ * @return Compressed size (including 16-byte header) or negative error code
+ */
+EA_EXPORT int ea_compress_comp(
+    const unsigned char *source,
+    int source_size,
+    unsigned char *dest,
+    int dest_size,
+    int level);
+
 /**
  * Get version string
  * @return Version string
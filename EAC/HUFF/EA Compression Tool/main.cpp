@@ -15,17 +15,32 @@
 #include "btreecodex.h"
 #include "jdlz_compression.h"
 #include "ea_comp.h"
+#include "comp_encode.h"
 #include <locale.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/stat.h>
 
 int ReadUint32(FILE *f);
 void WriteUint32(FILE *f, int n);
 unsigned char *alloc_mem(int size);
+unsigned char *InplaceBuffer(unsigned char *comp_data, int z_size, int size);
 void CloseFiles(FILE *infile, FILE *outfile, char *outfilename);
 void ED_Error(unsigned char *unp_data, unsigned char *comp_data, char *infilename, int err_code);
 void OutOfMemory(FILE *infile, FILE *outfile, char *outfilename, int err_code);
 void WriteUint32LE_InBuf(unsigned char *data, int n);
 void CreateHUFFHeader(unsigned char *header, int ulen, int zsize);
 int GetFilesize(FILE *f);
+int Benchmark(int argc, _TCHAR* argv[]);
+int Adversarial(int argc, _TCHAR* argv[]);
+int DecodeSweep(int argc, _TCHAR* argv[]);
+int TrainDictionary(int argc, _TCHAR* argv[]);
+unsigned char *ReadReferenceFile(char *filename, int *size);
+int DecodeIndexed(char *index_name, unsigned char *out, int out_sz, unsigned char *in, int z_size);
+int BenchLevel(char *cformat, char *variant);
+void FillAdversarial(int kind, unsigned char *data, int size);
+int BenchEncode(char *cformat, int level, int penalty, unsigned char *in, int in_sz, unsigned char *out);
+int BenchDecode(char *cformat, unsigned char *in, int z_size, unsigned char *out, int out_sz);
 void Help();
 
 int _tmain(int argc, _TCHAR* argv[])
@@ -37,6 +52,65 @@ int _tmain(int argc, _TCHAR* argv[])
 		Help();
 		return 0;
 	}
+	if (argc > 1 && strcmp(argv[1], "-b") == 0)
+		return Benchmark(argc, argv);
+	if (argc > 1 && strcmp(argv[1], "-a") == 0)
+		return Adversarial(argc, argv);
+	if (argc > 1 && strcmp(argv[1], "-s") == 0)
+		return DecodeSweep(argc, argv);
+	if (argc > 1 && strcmp(argv[1], "-t") == 0)
+		return TrainDictionary(argc, argv);
+
+	//-p dictfile in front of the args encodes or decodes REF with a dictionary
+	unsigned char *dict_data = NULL;
+	int dict_sz = 0;
+	if (argc > 2 && strcmp(argv[1], "-p") == 0)
+	{
+		dict_data = ReadReferenceFile(argv[2], &dict_sz);
+		if (!dict_data)
+			return 0;
+		argc -= 2;
+		argv += 2;
+		if (argc > 2 && strcmp(argv[1], "-c") == 0 && strcmp(argv[2], "REF") != 0)
+		{
+			printf("A dictionary can only be used with the REF format");
+			free(dict_data);
+			return 0;
+		}
+	}
+
+	//-o oldfile in front of the args makes or applies a REF patch against the old file
+	unsigned char *old_data = NULL;
+	int old_sz = 0;
+	if (argc > 2 && strcmp(argv[1], "-o") == 0 && !dict_data)
+	{
+		old_data = ReadReferenceFile(argv[2], &old_sz);
+		if (!old_data)
+			return 0;
+		argc -= 2;
+		argv += 2;
+		if (argc > 2 && strcmp(argv[1], "-c") == 0 && strcmp(argv[2], "REF") != 0)
+		{
+			printf("A patch can only be made with the REF format");
+			free(old_data);
+			return 0;
+		}
+	}
+
+	//-x indexfile in front of the -d args decodes HUFF on all cores with a sync point index,
+	//recorded by the first decode when the index file does not exist yet or is of other data
+	char *index_name = NULL;
+	if (argc > 2 && strcmp(argv[1], "-x") == 0 && !dict_data && !old_data)
+	{
+		index_name = argv[2];
+		argc -= 2;
+		argv += 2;
+		if (argc > 1 && strcmp(argv[1], "-d") != 0)
+		{
+			printf("An index can only be used with the -d mode");
+			return 0;
+		}
+	}
 
 	//ea_compression_tool.exe mode cformat infilename outfilename
 	if (argc > 6 || argc < 4)
@@ -46,6 +120,12 @@ int _tmain(int argc, _TCHAR* argv[])
 	}
 
 	int huff_comp_type = -1;
+	bool huff_threads = false;
+	int ref_level = REF_LEVEL_NORMAL;
+	bool ref_threads = false;
+	int comp_level = COMP_LEVEL_NORMAL;
+	int jdlz_level = 0;
+	bool jdlz_threads = false;
 
 	if (argc == 5 || argc == 6)
 	{
@@ -55,7 +135,7 @@ int _tmain(int argc, _TCHAR* argv[])
 			strcmp(argv[2], "BTREE") != 0 &&
 			strcmp(argv[2], "COMP") != 0)
 		{
-			printf("The '%s' compression format is not supported! Must be HUFF, JDLZ, REF or BTREE", argv[2]);
+			printf("The '%s' compression format is not supported! Must be HUFF, JDLZ, REF, BTREE or COMP", argv[2]);
 			return 0;
 		}
 		if (strcmp(argv[2], "HUFF") == 0)
@@ -66,16 +146,78 @@ int _tmain(int argc, _TCHAR* argv[])
 				huff_comp_type = 1;
 			else if (strcmp(argv[3], "-2") == 0)
 				huff_comp_type = 2;
+			else if (strcmp(argv[3], "-3") == 0)
+				huff_comp_type = 0 | HUFF_OPT_4STREAMS;
+			else if (strcmp(argv[3], "-4") == 0)
+				huff_comp_type = 1 | HUFF_OPT_4STREAMS;
+			else if (strcmp(argv[3], "-5") == 0)
+				huff_comp_type = 2 | HUFF_OPT_4STREAMS;
+			else if (strcmp(argv[3], "-t") == 0)
+			{
+				huff_comp_type = 0;
+				huff_threads = true;
+			}
 			else
 			{
 				printf("The compression mode for the HUFF compression is invalid.\n");
-				printf("Must be -0, -1 or -2. The NFS Most Wanted and NFS Carbon\n");
+				printf("Must be -0 to -5, or -t (-0 on all cores). The NFS Most Wanted and NFS Carbon\n");
 				printf("games uses the 0 mode, 0x30FB header.\n");
 				return 0;
 			}
 			infilename = argv[4];
 			outfilename = argv[5];
 		}
+		else if (argc == 6 && strcmp(argv[2], "REF") == 0)
+		{
+			if (strcmp(argv[3], "-0") == 0)
+				ref_level = REF_LEVEL_NORMAL;
+			else if (strcmp(argv[3], "-1") == 0)
+				ref_level = REF_LEVEL_MAX;
+			else if (strcmp(argv[3], "-2") == 0)
+				ref_level = REF_LEVEL_FAST;
+			else if (strcmp(argv[3], "-t") == 0)
+				ref_threads = true;
+			else
+			{
+				printf("The compression level for the REF compression is invalid.\n");
+				printf("Must be -0 (default), -1 (best ratio), -2 (fastest) or -t (all cores).\n");
+				return 0;
+			}
+			infilename = argv[4];
+			outfilename = argv[5];
+		}
+		else if (argc == 6 && strcmp(argv[2], "JDLZ") == 0)
+		{
+			if (strcmp(argv[3], "-0") == 0)
+				jdlz_level = 0;
+			else if (strcmp(argv[3], "-1") == 0)
+				jdlz_level = 1;
+			else if (strcmp(argv[3], "-t") == 0)
+				jdlz_threads = true;
+			else
+			{
+				printf("The compression level for the JDLZ compression is invalid.\n");
+				printf("Must be -0 (default), -1 (best ratio) or -t (all cores).\n");
+				return 0;
+			}
+			infilename = argv[4];
+			outfilename = argv[5];
+		}
+		else if (argc == 6 && strcmp(argv[2], "COMP") == 0)
+		{
+			if (strcmp(argv[3], "-0") == 0)
+				comp_level = COMP_LEVEL_NORMAL;
+			else if (strcmp(argv[3], "-1") == 0)
+				comp_level = COMP_LEVEL_MAX;
+			else
+			{
+				printf("The compression level for the COMP compression is invalid.\n");
+				printf("Must be -0 (default) or -1 (best ratio).\n");
+				return 0;
+			}
+			infilename = argv[4];
+			outfilename = argv[5];
+		}
 		else
 		{
 			infilename = argv[3];
@@ -135,29 +277,49 @@ int _tmain(int argc, _TCHAR* argv[])
 				OutOfMemory(infile, outfile, outfilename, 1);
 				return 0;
 			}
-
-			unp_data = alloc_mem(unpacked_size);
-			if (!unp_data)
-			{
-				free(comp_data);
-				OutOfMemory(infile, outfile, outfilename, 2);
-				return 0;
-			}
 			if (hdr[0] == 'C') z_size -= 16;
-			fread(comp_data, 1, z_size, infile);
+			int read_sz = fread(comp_data, 1, z_size, infile);
 
+			int margin = -1;
 			if (strcmp(hdr, "JDLZ") == 0)
+				margin = JDLZ_Inplace_Margin(comp_data, read_sz, unpacked_size);
+			if (margin >= 0)
 			{
-				ret_value = JDLZ_Decompress(comp_data, z_size, unp_data, unpacked_size);
-			}
-			else if (strcmp(hdr, "COMP") == 0)
-			{
-				ret_value = COMP_Decompress(comp_data, z_size, unp_data, unpacked_size);
+				unp_data = InplaceBuffer(comp_data, read_sz, unpacked_size + margin);
+				if (!unp_data)
+				{
+					free(comp_data);
+					OutOfMemory(infile, outfile, outfilename, 2);
+					return 0;
+				}
+				comp_data = NULL;
+				ret_value = JDLZ_Decompress_Inplace(unp_data, unpacked_size + margin, read_sz, unpacked_size);
 			}
 			else
 			{
-				if (HUFF_is(comp_data))
-					ret_value = HUFF_decode(unp_data, comp_data, &z_size);
+				unp_data = alloc_mem(unpacked_size);
+				if (!unp_data)
+				{
+					free(comp_data);
+					OutOfMemory(infile, outfile, outfilename, 2);
+					return 0;
+				}
+
+				if (strcmp(hdr, "JDLZ") == 0)
+				{
+					ret_value = JDLZ_Decompress(comp_data, z_size, unp_data, unpacked_size);
+				}
+				else if (strcmp(hdr, "COMP") == 0)
+				{
+					ret_value = COMP_Decompress(comp_data, z_size, unp_data, unpacked_size);
+				}
+				else
+				{
+					if (HUFF_is(comp_data) && index_name)
+						ret_value = DecodeIndexed(index_name, unp_data, unpacked_size, comp_data, z_size);
+					else if (HUFF_is(comp_data))
+						ret_value = HUFF_decode_fast(unp_data, unpacked_size, comp_data, z_size);
+				}
 			}
 		}
 		else
@@ -170,12 +332,29 @@ int _tmain(int argc, _TCHAR* argv[])
 				return 0;
 			}
 			fread(comp_data, 1, z_size, infile);
-			if (REF_is(comp_data))
+			if (old_data)
+				unpacked_size = z_size >= 16 ? qmax(REF_patch_size(comp_data), 0) : 0;
+			else if (REF_is(comp_data))
 				unpacked_size = REF_size(comp_data);
 			else if (BTREE_is(comp_data))
 				unpacked_size = BTREE_size(comp_data);
 
-			if (unpacked_size != 0)
+			int margin = -1;
+			if (unpacked_size != 0 && REF_is(comp_data) && !dict_data)
+				margin = REF_inplace_margin(comp_data, z_size);
+			if (margin >= 0)
+			{
+				unp_data = InplaceBuffer(comp_data, z_size, unpacked_size + margin);
+				if (!unp_data)
+				{
+					free(comp_data);
+					OutOfMemory(infile, outfile, outfilename, 2);
+					return 0;
+				}
+				comp_data = NULL;
+				ret_value = REF_decode_inplace(unp_data, unpacked_size + margin, z_size);
+			}
+			else if (unpacked_size != 0)
 			{
 				unp_data = alloc_mem(unpacked_size);
 				if (!unp_data)
@@ -184,10 +363,14 @@ int _tmain(int argc, _TCHAR* argv[])
 					OutOfMemory(infile, outfile, outfilename, 2);
 					return 0;
 				}
-				if (REF_is(comp_data))
-					ret_value = REF_decode(unp_data, comp_data, &z_size);
+				if (old_data)
+					ret_value = REF_decode_patch(unp_data, unpacked_size, comp_data, z_size, old_data, old_sz);
+				else if (REF_is(comp_data) && dict_data)
+					ret_value = REF_decode_dict(unp_data, unpacked_size, comp_data, z_size, dict_data, dict_sz);
+				else if (REF_is(comp_data))
+					ret_value = REF_decode_safe(unp_data, unpacked_size, comp_data, z_size);
 				else
-					ret_value = BTREE_decode(unp_data, comp_data, &z_size);
+					ret_value = BTREE_decode_safe(unp_data, unpacked_size, comp_data, z_size);
 			}
 			else unpacked_size = 1;
 		}
@@ -214,7 +397,7 @@ int _tmain(int argc, _TCHAR* argv[])
 			return 0;
 		}
 
-		comp_data = alloc_mem(in_sz * 2);
+		comp_data = alloc_mem(in_sz * 2 + 64);
 		if (!comp_data)
 		{
 			free(unp_data);
@@ -225,20 +408,40 @@ int _tmain(int argc, _TCHAR* argv[])
 
 		if (strcmp(argv[2], "HUFF") == 0)
 		{
-			ret_value = HUFF_encode(comp_data, unp_data, in_sz, &huff_comp_type);
+			if (huff_threads)
+				ret_value = HUFF_encode_mt(comp_data, unp_data, in_sz, &huff_comp_type, 0);
+			else
+				ret_value = HUFF_encode(comp_data, unp_data, in_sz, &huff_comp_type);
 		}
 		else if (strcmp(argv[2], "JDLZ") == 0)
 		{
-			ret_value = JDLZ_Compress(unp_data, in_sz, comp_data);
+			if (jdlz_level == 1)
+				ret_value = JDLZ_Compress_Opt(unp_data, in_sz, comp_data);
+			else if (jdlz_threads)
+				ret_value = JDLZ_Compress_MT(unp_data, in_sz, comp_data, 0);
+			else
+				ret_value = JDLZ_Compress(unp_data, in_sz, comp_data);
 		}
 		else if (strcmp(argv[2], "REF") == 0)
 		{
-			ret_value = REF_encode(comp_data, unp_data, in_sz, 0);
+			if (old_data)
+				ret_value = REF_encode_patch(comp_data, unp_data, in_sz, old_data, old_sz, &ref_level);
+			else if (dict_data)
+				ret_value = REF_encode_dict(comp_data, unp_data, in_sz, dict_data, dict_sz, &ref_level);
+			else if (ref_threads)
+				ret_value = REF_encode_mt(comp_data, unp_data, in_sz, &ref_level, 0);
+			else
+				ret_value = REF_encode(comp_data, unp_data, in_sz, &ref_level);
 		}
 		else if (strcmp(argv[2], "BTREE") == 0)
 		{
             ret_value = BTREE_encode(comp_data, unp_data, in_sz, 0);
 		}
+		else if (strcmp(argv[2], "COMP") == 0)
+		{
+			COMP_Encoder comp_encoder;
+			ret_value = comp_encoder.COMP_encode(unp_data, in_sz, comp_data, comp_level);
+		}
 
 		if (!ret_value)
 		{
@@ -253,6 +456,13 @@ int _tmain(int argc, _TCHAR* argv[])
 			CreateHUFFHeader(huff_hdr, in_sz, ret_value);
 			fwrite(huff_hdr, 1, 16, outfile);
 		}
+		else if (strcmp(argv[2], "COMP") == 0)
+		{
+			unsigned char comp_hdr[16];
+			COMP_Encoder comp_encoder;
+			comp_encoder.COMP_createHeader(comp_hdr, in_sz, ret_value);
+			fwrite(comp_hdr, 1, 16, outfile);
+		}
 		//write the compressed data to disk
 		fwrite(comp_data, 1, ret_value, outfile);
 	}
@@ -261,6 +471,8 @@ int _tmain(int argc, _TCHAR* argv[])
 	fclose(outfile);
 	free(unp_data);
 	free(comp_data);
+	free(dict_data);
+	free(old_data);
 	return 1;
 }
 
@@ -314,6 +526,17 @@ unsigned char *alloc_mem(int size)
 	return (((unsigned char*)malloc(sizeof(unsigned char)* size)));
 }
 
+//Grows the buffer holding the compressed data to size bytes and moves
+//the data to its end, to be decoded over in place. The decoded file then
+//needs only its own size plus the stream's margin, not both copies.
+unsigned char *InplaceBuffer(unsigned char *comp_data, int z_size, int size)
+{
+	unsigned char *data = (unsigned char*)realloc(comp_data, size);
+	if (data)
+		memmove(data + size - z_size, data, z_size);
+	return data;
+}
+
 void CreateHUFFHeader(unsigned char *header, int ulen, int zsize)
 {
 	const char *huff_id = "HUFF";
@@ -341,6 +564,500 @@ int GetFilesize(FILE *f)
 	return size;
 }
 
+//ea_compression_tool.exe -b cformat [-v] infilename
+//encodes the file and decodes it back, repeating each for about a
+//second, and prints the ratio and the throughput over the unpacked size
+int Benchmark(int argc, _TCHAR* argv[])
+{
+	if (argc != 4 && argc != 5)
+	{
+		printf("Usage: ea_compression_tool.exe -b cformat [-v] infile");
+		return 0;
+	}
+	char *cformat = argv[2];
+	char *infilename = argv[argc - 1];
+	int level = BenchLevel(cformat, argc == 5 ? argv[3] : NULL);
+	if (level < 0)
+		return 0;
+
+	FILE *infile = fopen(infilename, "rb");
+	if (!infile)
+	{
+		printf("Unable to access the '%s' input file", infilename);
+		return 0;
+	}
+	int in_sz = GetFilesize(infile);
+	unsigned char *unp_data = alloc_mem(in_sz);
+	unsigned char *comp_data = alloc_mem(in_sz * 2 + 64);
+	unsigned char *dec_data = alloc_mem(in_sz);
+	if (!unp_data || !comp_data || !dec_data)
+	{
+		printf("Unable to allocate memory to read the input data");
+		free(unp_data);
+		free(comp_data);
+		free(dec_data);
+		fclose(infile);
+		return 0;
+	}
+	fread(unp_data, 1, in_sz, infile);
+	fclose(infile);
+
+	int z_size = 0, ret_value = 0, rounds;
+	clock_t start, ticks;
+
+	rounds = 0;
+	start = clock();
+	do
+	{
+		z_size = BenchEncode(cformat, level, 0, unp_data, in_sz, comp_data);
+		rounds++;
+		ticks = clock() - start;
+	} while (z_size > 0 && ticks < CLOCKS_PER_SEC);
+	double enc_speed = (double)in_sz * rounds / 1000000.0 / ((double)(ticks ? ticks : 1) / CLOCKS_PER_SEC);
+
+	rounds = 0;
+	start = clock();
+	do
+	{
+		ret_value = BenchDecode(cformat, comp_data, z_size, dec_data, in_sz);
+		rounds++;
+		ticks = clock() - start;
+	} while (z_size > 0 && ticks < CLOCKS_PER_SEC);
+	double dec_speed = (double)in_sz * rounds / 1000000.0 / ((double)(ticks ? ticks : 1) / CLOCKS_PER_SEC);
+
+	//JDLZ, COMP and HUFF are also decoded with the simple loop, which must
+	//agree. For HUFF it is the 16 bit bit reader of HUFF_decode_safe
+	double simple_speed = 0;
+	bool jdlz = strcmp(cformat, "JDLZ") == 0;
+	bool huff = strcmp(cformat, "HUFF") == 0;
+	if ((jdlz || huff || strcmp(cformat, "COMP") == 0) && z_size > 0 && ret_value == in_sz)
+	{
+		rounds = 0;
+		start = clock();
+		do
+		{
+			if (jdlz)
+				ret_value = JDLZ_Decompress_Simple(comp_data + 16, z_size - 16, dec_data, in_sz);
+			else if (huff)
+				ret_value = HUFF_decode_safe(dec_data, in_sz, comp_data, z_size);
+			else
+				ret_value = COMP_Decompress_Simple(comp_data, z_size, dec_data, in_sz);
+			rounds++;
+			ticks = clock() - start;
+		} while (ticks < CLOCKS_PER_SEC);
+		simple_speed = (double)in_sz * rounds / 1000000.0 / ((double)(ticks ? ticks : 1) / CLOCKS_PER_SEC);
+	}
+
+	if (z_size <= 0 || ret_value != in_sz || memcmp(unp_data, dec_data, in_sz) != 0)
+		printf("%s: the decoded data does not match the input file '%s'\n", cformat, infilename);
+	else
+	{
+		printf("%s -%d: %d -> %d bytes (%.2f%%)\n", cformat, level, in_sz, z_size, 100.0 * z_size / (in_sz ? in_sz : 1));
+		printf("encode: %.2f MB/s\n", enc_speed);
+		printf("decode: %.2f MB/s\n", dec_speed);
+		if (simple_speed > 0)
+			printf("decode (simple loop): %.2f MB/s, %.2fx\n", simple_speed, dec_speed / simple_speed);
+	}
+	free(unp_data);
+	free(comp_data);
+	free(dec_data);
+	return 1;
+}
+
+//ea_compression_tool.exe -s cformat [-v] infilename
+//encodes the file with a growing command penalty (REF and JDLZ) and
+//prints the ratio and the decode speed of each, against no penalty
+int DecodeSweep(int argc, _TCHAR* argv[])
+{
+	static const int penalties[] = { 0, 1, 2, 3, 4, 6, 8, 12, 16 };
+	const int count = sizeof(penalties) / sizeof(penalties[0]);
+
+	if (argc != 4 && argc != 5)
+	{
+		printf("Usage: ea_compression_tool.exe -s cformat [-v] infile");
+		return 0;
+	}
+	char *cformat = argv[2];
+	char *infilename = argv[argc - 1];
+	if (strcmp(cformat, "REF") != 0 && strcmp(cformat, "JDLZ") != 0)
+	{
+		printf("The '%s' compression format has no command penalty! Must be REF or JDLZ", cformat);
+		return 0;
+	}
+	int level = BenchLevel(cformat, argc == 5 ? argv[3] : NULL);
+	if (level < 0)
+		return 0;
+
+	FILE *infile = fopen(infilename, "rb");
+	if (!infile)
+	{
+		printf("Unable to access the '%s' input file", infilename);
+		return 0;
+	}
+	int in_sz = GetFilesize(infile);
+	unsigned char *unp_data = alloc_mem(in_sz);
+	unsigned char *comp_data = alloc_mem(in_sz * 2 + 64);
+	unsigned char *dec_data = alloc_mem(in_sz);
+	if (!unp_data || !comp_data || !dec_data)
+	{
+		printf("Unable to allocate memory to read the input data");
+		free(unp_data);
+		free(comp_data);
+		free(dec_data);
+		fclose(infile);
+		return 0;
+	}
+	fread(unp_data, 1, in_sz, infile);
+	fclose(infile);
+
+	double base_ratio = 0, base_speed = 0;
+	printf("%s -%d: %d bytes\n", cformat, level, in_sz);
+	printf("penalty      bytes    ratio   decode MB/s\n");
+	for (int i = 0; i < count; i++)
+	{
+		int z_size = BenchEncode(cformat, level, penalties[i], unp_data, in_sz, comp_data);
+		int ret_value = 0, rounds = 0;
+		clock_t start = clock(), ticks;
+		do
+		{
+			ret_value = BenchDecode(cformat, comp_data, z_size, dec_data, in_sz);
+			rounds++;
+			ticks = clock() - start;
+		} while (z_size > 0 && ticks < CLOCKS_PER_SEC);
+		if (z_size <= 0 || ret_value != in_sz || memcmp(unp_data, dec_data, in_sz) != 0)
+		{
+			printf("%s: the decoded data does not match the input file '%s'\n", cformat, infilename);
+			continue;
+		}
+		double ratio = 100.0 * z_size / (in_sz ? in_sz : 1);
+		double dec_speed = (double)in_sz * rounds / 1000000.0 / ((double)(ticks ? ticks : 1) / CLOCKS_PER_SEC);
+		if (i == 0)
+		{
+			base_ratio = ratio;
+			base_speed = dec_speed;
+		}
+		printf("%7d %10d  %6.2f%%  %8.2f  (%+.2f%% size, %+.1f%% speed)\n", penalties[i], z_size, ratio, dec_speed,
+			ratio - base_ratio, base_speed > 0 ? 100.0 * (dec_speed / base_speed - 1) : 0.0);
+	}
+	free(unp_data);
+	free(comp_data);
+	free(dec_data);
+	return 1;
+}
+
+//ea_compression_tool.exe -t dictfile sampledir [dictsize]
+//reads every file of the directory as a sample and writes a REF dictionary
+int TrainDictionary(int argc, _TCHAR* argv[])
+{
+	if (argc != 4 && argc != 5)
+	{
+		printf("Usage: ea_compression_tool.exe -t dictfile sampledir [dictsize]");
+		return 0;
+	}
+	int dict_cap = (argc == 5) ? atoi(argv[4]) : 65536;
+	if (dict_cap <= 0 || dict_cap > 131072)
+	{
+		printf("The dictionary size must be 1 to 131072 bytes");
+		return 0;
+	}
+	DIR *dir = opendir(argv[3]);
+	if (!dir)
+	{
+		printf("Unable to access the '%s' sample directory", argv[3]);
+		return 0;
+	}
+
+	unsigned char *samples = NULL;
+	int *sample_sizes = NULL;
+	int num_samples = 0, total = 0;
+	struct dirent *entry;
+	char path[1024];
+	while ((entry = readdir(dir)) != NULL)
+	{
+		struct stat st;
+		snprintf(path, sizeof(path), "%s/%s", argv[3], entry->d_name);
+		if (stat(path, &st) != 0 || (st.st_mode & S_IFMT) != S_IFREG || st.st_size <= 0)
+			continue;
+		FILE *f = fopen(path, "rb");
+		if (!f)
+			continue;
+		int size = GetFilesize(f);
+		unsigned char *grown = (unsigned char *)realloc(samples, total + size);
+		int *grown_sizes = (int *)realloc(sample_sizes, (num_samples + 1) * sizeof(int));
+		if (grown) samples = grown;
+		if (grown_sizes) sample_sizes = grown_sizes;
+		if (!grown || !grown_sizes)
+		{
+			printf("Unable to allocate memory to read the samples");
+			fclose(f);
+			closedir(dir);
+			free(samples);
+			free(sample_sizes);
+			return 0;
+		}
+		sample_sizes[num_samples++] = (int)fread(samples + total, 1, size, f);
+		total += sample_sizes[num_samples - 1];
+		fclose(f);
+	}
+	closedir(dir);
+
+	unsigned char *dict_data = alloc_mem(dict_cap);
+	int dict_sz = dict_data ? REF_train_dict(dict_data, dict_cap, samples, sample_sizes, num_samples) : 0;
+	free(samples);
+	free(sample_sizes);
+	if (dict_sz <= 0)
+	{
+		printf("No dictionary was made, the %d samples share no content", num_samples);
+		free(dict_data);
+		return 0;
+	}
+	FILE *outfile = fopen(argv[2], "wb");
+	if (!outfile)
+	{
+		printf("Unable to create the '%s' output file", argv[2]);
+		free(dict_data);
+		return 0;
+	}
+	fwrite(dict_data, 1, dict_sz, outfile);
+	fclose(outfile);
+	free(dict_data);
+	printf("%d samples, %d bytes -> %d bytes dictionary\n", num_samples, total, dict_sz);
+	return 1;
+}
+
+unsigned char *ReadReferenceFile(char *filename, int *size)
+{
+	FILE *f = fopen(filename, "rb");
+	if (!f)
+	{
+		printf("Unable to access the '%s' file", filename);
+		return NULL;
+	}
+	*size = GetFilesize(f);
+	unsigned char *data = alloc_mem(*size ? *size : 1);
+	if (!data)
+	{
+		printf("Unable to allocate memory to read the '%s' file", filename);
+		fclose(f);
+		return NULL;
+	}
+	*size = (int)fread(data, 1, *size, f);
+	fclose(f);
+	return data;
+}
+
+//Decodes HUFF on all cores with the sync point index in index_name, or
+//decodes it once and records the index there when the file does not exist
+//or was made of other data
+int DecodeIndexed(char *index_name, unsigned char *out, int out_sz, unsigned char *in, int z_size)
+{
+	int ret_value, index_sz;
+	unsigned char *index;
+	FILE *f = fopen(index_name, "rb");
+	if (f)
+	{
+		fclose(f);
+		index = ReadReferenceFile(index_name, &index_sz);
+		if (!index)
+			return -1;
+		ret_value = HUFF_decode_mt(out, out_sz, in, z_size, index, index_sz, 0);
+		free(index);
+		if (ret_value > 0)
+			return ret_value;
+	}
+
+	index_sz = HUFF_index_size(out_sz, 0);
+	index = alloc_mem(index_sz);
+	if (!index)
+		return -1;
+	ret_value = HUFF_decode_index(out, out_sz, in, z_size, index, &index_sz, 0);
+	if (ret_value > 0)
+	{
+		f = fopen(index_name, "wb");
+		if (f)
+		{
+			fwrite(index, 1, index_sz, f);
+			fclose(f);
+		}
+		else
+			printf("Unable to create the '%s' index file\n", index_name);
+	}
+	free(index);
+	return ret_value;
+}
+
+//Encode speed on generated data that is hard on the match search: runs,
+//short periods, a Fibonacci word, random data over 2 and 4 symbols and
+//repeated blocks with noise. Prints each one and the slowest. For HUFF it
+//also checks that HUFF_decode_safe turns down known hostile streams.
+int Adversarial(int argc, _TCHAR* argv[])
+{
+	static const char *names[] = { "zeros", "period 2", "period 127", "fibonacci", "random bits",
+		"random 2 bits", "noisy blocks", "sparse runs" };
+	const int kinds = 8;
+	const int in_sz = 4 << 20;
+
+	if (argc != 3 && argc != 4)
+	{
+		printf("Usage: ea_compression_tool.exe -a cformat [-v]");
+		return 0;
+	}
+	char *cformat = argv[2];
+	int level = BenchLevel(cformat, argc == 4 ? argv[3] : NULL);
+	if (level < 0)
+		return 0;
+
+	unsigned char *unp_data = alloc_mem(in_sz);
+	unsigned char *comp_data = alloc_mem(in_sz * 2 + 64);
+	unsigned char *dec_data = alloc_mem(in_sz);
+	if (!unp_data || !comp_data || !dec_data)
+	{
+		printf("Unable to allocate memory for the test data");
+		free(unp_data);
+		free(comp_data);
+		free(dec_data);
+		return 0;
+	}
+
+	double worst = 0;
+	int worst_kind = 0;
+	for (int kind = 0; kind < kinds; kind++)
+	{
+		FillAdversarial(kind, unp_data, in_sz);
+		clock_t start = clock();
+		int z_size = BenchEncode(cformat, level, 0, unp_data, in_sz, comp_data);
+		clock_t ticks = clock() - start;
+		double enc_speed = (double)in_sz / 1000000.0 / ((double)(ticks ? ticks : 1) / CLOCKS_PER_SEC);
+
+		if (z_size <= 0 || BenchDecode(cformat, comp_data, z_size, dec_data, in_sz) != in_sz ||
+			memcmp(unp_data, dec_data, in_sz) != 0)
+		{
+			printf("%s: the decoded data does not match the %s input\n", cformat, names[kind]);
+			continue;
+		}
+		printf("%-14s %9d bytes  encode: %.2f MB/s\n", names[kind], z_size, enc_speed);
+		if (kind == 0 || enc_speed < worst)
+		{
+			worst = enc_speed;
+			worst_kind = kind;
+		}
+	}
+	if (strcmp(cformat, "HUFF") == 0)
+	{ //a 30fb header whose first bit count starts with more zeros than any number has
+		static const unsigned char endless_num[12] = { 0x30, 0xfb, 0x00, 0x00, 0x10, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x00 };
+		int r = HUFF_decode_safe(dec_data, in_sz, endless_num, sizeof(endless_num));
+		printf("%-14s %s\n", "long number", r < 0 ? "rejected" : "NOT REJECTED");
+	}
+	printf("%s -%d slowest: %.2f MB/s (%s)\n", cformat, level, worst, names[worst_kind]);
+	free(unp_data);
+	free(comp_data);
+	free(dec_data);
+	return 1;
+}
+
+void FillAdversarial(int kind, unsigned char *data, int size)
+{
+	unsigned int seed = 12345;
+	int i, a, b;
+
+	if (kind == 3)
+	{ //Fibonacci word, built by appending the previous word
+		data[0] = 'a';
+		data[1] = 'b';
+		a = 1;
+		b = 2;
+		while (b < size)
+		{
+			memcpy(data + b, data, (a < size - b) ? a : size - b);
+			int c = a + b;
+			a = b;
+			b = c;
+		}
+		return;
+	}
+	for (i = 0; i < size; i++)
+	{
+		seed = seed * 1103515245 + 12345;
+		unsigned int r = seed >> 16;
+		switch (kind)
+		{
+		case 0: data[i] = 0; break;
+		case 1: data[i] = i & 1; break;
+		case 2: data[i] = (unsigned char)((i % 127) * 7); break;
+		case 4: data[i] = r & 1; break;
+		case 5: data[i] = r & 3; break;
+		case 6: data[i] = (unsigned char)(i % 4096) ^ (r % 509 == 0); break;
+		default: data[i] = ((i / 1000) & 1) ? 0 : (r % 97 == 0); break;
+		}
+	}
+}
+
+//the -v variant of the -b, -a and -s modes, -1 if it is invalid for the format
+int BenchLevel(char *cformat, char *variant)
+{
+	int max_level = -1;
+
+	if (strcmp(cformat, "HUFF") == 0) max_level = 5;
+	else if (strcmp(cformat, "REF") == 0) max_level = REF_LEVEL_FAST;
+	else if (strcmp(cformat, "COMP") == 0) max_level = COMP_LEVEL_MAX;
+	else if (strcmp(cformat, "JDLZ") == 0) max_level = 1;
+	else if (strcmp(cformat, "BTREE") == 0) max_level = 0;
+	if (max_level < 0)
+	{
+		printf("The '%s' compression format is not supported! Must be HUFF, JDLZ, REF, BTREE or COMP", cformat);
+		return -1;
+	}
+	if (!variant)
+		return 0;
+	if (variant[0] != '-' || variant[1] < '0' || variant[1] > '0' + max_level || variant[2] != 0)
+	{
+		printf("The '%s' variant is invalid for the %s format", variant, cformat);
+		return -1;
+	}
+	return variant[1] - '0';
+}
+
+//penalty is the REF_OPT_DECODE command penalty of REF and JDLZ
+int BenchEncode(char *cformat, int level, int penalty, unsigned char *in, int in_sz, unsigned char *out)
+{
+	if (strcmp(cformat, "HUFF") == 0)
+	{
+		int opt = level >= 3 ? (level - 3) | HUFF_OPT_4STREAMS : level;
+		return HUFF_encode(out, in, in_sz, &opt);
+	}
+	else if (strcmp(cformat, "JDLZ") == 0)
+		return level == 1 ? JDLZ_Compress_Opt(in, in_sz, out, penalty) : JDLZ_Compress(in, in_sz, out, penalty);
+	else if (strcmp(cformat, "REF") == 0)
+	{
+		int opts[4] = { level | REF_OPT_DECODE, 0, 0, penalty };
+		return REF_encode(out, in, in_sz, opts);
+	}
+	else if (strcmp(cformat, "BTREE") == 0)
+		return BTREE_encode(out, in, in_sz, 0);
+	else if (strcmp(cformat, "COMP") == 0)
+	{
+		COMP_Encoder comp_encoder;
+		return comp_encoder.COMP_encode(in, in_sz, out, level);
+	}
+	return 0;
+}
+
+//the HUFF and COMP data are without their 16 bytes header
+int BenchDecode(char *cformat, unsigned char *in, int z_size, unsigned char *out, int out_sz)
+{
+	if (strcmp(cformat, "HUFF") == 0)
+		return HUFF_decode_fast(out, out_sz, in, z_size);
+	else if (strcmp(cformat, "JDLZ") == 0)
+		return JDLZ_Decompress(in + 16, z_size - 16, out, out_sz);
+	else if (strcmp(cformat, "REF") == 0)
+		return REF_decode(out, in, &z_size);
+	else if (strcmp(cformat, "BTREE") == 0)
+		return BTREE_decode(out, in, &z_size);
+	else if (strcmp(cformat, "COMP") == 0)
+		return COMP_Decompress(in, z_size, out, out_sz);
+	return 0;
+}
+
 void Help()
 {
 	printf("\nEA Compression Tool\n\n");
@@ -350,21 +1067,27 @@ void Help()
 		printf("Coded by Rayne Games\n\n");
 	#endif
 	printf("WARNING: Contains proprietary code of EA!!\n\n");
-	printf("Use this tool to encode/decode the files compressed in HUFF, JDLZ, REF and BTREE formats.\n\n");
+	printf("Use this tool to encode/decode the files compressed in HUFF, JDLZ, REF, BTREE and COMP formats.\n\n");
 	printf("The JDLZ compression is based on LZMA and it is often used to compress VPAK files\n");
-	printf("and also BUN/LZC files and some other EA games, outside of Need for Speed.\n\n");
+	printf("and also BUN/LZC files and some other EA games, outside of Need for Speed.\n");
+	printf("It accepts an optional level before the infile: -0 greedy parse, the default, -1 optimal parse,\n");
+	printf("slower but with the best ratio, or -t greedy parse on all cores, in 256 KB blocks. The output does\n");
+	printf("not depend on the core count.\n\n");
 	printf("The HUFF compression is based on Huffman coding (Huffman with Runlength Codex),\n");
 	printf("which it is used in many EA games as Need for Speed Most Wanted and the Carbon\n");
 	printf("to store texture data. The Huffman reach a compression ratio better than JDLZ.\n\n");
 	printf("Usage:\nea_compression_tool.exe mode cformat -v infile outfile\n\n");
 	printf("mode: -d to decode a file, -c to encode a file\n\n");
-	printf("cformat: HUFF, JDLZ, REF and BTREE. If the -c mode is used,\nallows you choose which compression format ");
+	printf("cformat: HUFF, JDLZ, REF, BTREE and COMP. If the -c mode is used,\nallows you choose which compression format ");
 	printf("will used to compress the input file.\n\n");
-	printf("-v: Only to the HUFF format. Allow you choose a HUFF compression variant.\n");
+	printf("-v: For the HUFF and REF formats. Allow you choose a compression variant.\n");
 	printf("The following variants are available:\n");
 	printf("-0: 0x30fb header. Used in games like NFS Most Wanted and NFS Carbon\n");
 	printf("-1: 0x32fb header. Probably used in other EA games\n");
     printf("-2: 0x34fb header. Probably used in other EA games\n");
+	printf("-3, -4, -5: 0x38fb, 0x3afb and 0x3cfb headers, the -0, -1 and -2 variants split in 4 streams\n");
+	printf("that decode faster. Only this tool reads them\n");
+	printf("-t: the -0 variant with the codes packed on all cores, in 256 KB chunks. The output is the same as -0\n");
 	printf("\n\nExample:\n");
 	printf("ea_compression_tool.exe -c HUFF -0 infile outfile\n");
 	printf("The args above compress the input file with the HUFF compression and save the data to output file.\n");
@@ -372,15 +1095,51 @@ void Help()
 	printf("\n\nTo decompress a file, select the -d mode and the infile name and the outfile name\n");
 	printf("Example: ea_compression_tool.exe -d GAMEPLAY.LZC decoded\n");
 	printf("The tool automatically detect the compression format\n\n");
+	printf("To measure a format on a file, select the -b mode, the cformat, the optional -v and the infile name\n");
+	printf("Example: ea_compression_tool.exe -b REF -1 infile\n");
+	printf("The file is encoded and decoded back in memory and the ratio and speeds are printed\n\n");
+	printf("To make a REF dictionary for small files, select the -t mode, the dictfile, a directory of sample files\n");
+	printf("and the optional dictionary size (65536 by default, 131072 at most)\n");
+	printf("Example: ea_compression_tool.exe -t records.dict samples\n");
+	printf("Put -p and the dictfile in front of the args to encode or decode REF files with it\n");
+	printf("Example: ea_compression_tool.exe -p records.dict -c REF infile outfile\n");
+	printf("The same dictionary is needed to decode the file\n\n");
+	printf("To make a REF patch, put -o and the previous version of the file in front of the args to encode\n");
+	printf("Example: ea_compression_tool.exe -o old.bin -c REF new.bin new.patch\n");
+	printf("Only what changed is stored. The same -o oldfile rebuilds the new file with the -d mode\n");
+	printf("Example: ea_compression_tool.exe -o old.bin -d new.patch new.bin\n\n");
+	printf("To decode a HUFF file on all cores, put -x and an index file in front of the -d args\n");
+	printf("Example: ea_compression_tool.exe -x GAMEPLAY.idx -d GAMEPLAY.HUF decoded\n");
+	printf("The first decode records where each 64KB of output starts in the index file,\n");
+	printf("the next decodes split the file there and decode the parts side by side. An index of other data\n");
+	printf("is made again\n\n");
+	printf("To measure the worst case encode speed, select the -a mode, the cformat and the optional -v\n");
+	printf("Example: ea_compression_tool.exe -a REF -0\n");
+	printf("Generated data that is hard on the match search (runs, short periods, random bits...) is encoded\n");
+	printf("and the speed on each and the slowest are printed\n\n");
+	printf("To weigh the ratio against the decode speed, select the -s mode, REF or JDLZ, the optional -v and the infile\n");
+	printf("Example: ea_compression_tool.exe -s REF -1 infile\n");
+	printf("The file is encoded with a growing penalty on each command, fewer and longer commands decode faster,\n");
+	printf("and the ratio and decode speed of each are printed\n\n");
     printf("About the REF and BTREE formats\n\n");
 	printf("The REF a.k.a refpack is other compression format developed by EA for use in some of its games.\n");
 	printf("I don't know exactly which games use this compression, but you can encode and decode files with\n");
 	printf("the REF encoding when choosing the REF argument in the -c mode.\n\n");
+	printf("The REF format accepts an optional level before the infile:\n");
+	printf("-0: greedy parse, the default\n");
+	printf("-1: optimal parse. Slower, but gives the best ratio\n");
+	printf("-2: one hash probe per byte. Hundreds of MB/s for hot reloads, at a lower ratio\n");
+	printf("-t: greedy parse on all cores, in 512 KB blocks. The output does not depend on the core count\n\n");
 	printf("For files larger than 0xffffff, the 0x90fb header is used.\n");
 	printf("For files smaller than 0xffffff, the 0x10fb header is used.\n\n");
 	printf("BTREE format\n\n");
 	printf("Is other compression format also developed by EA. I don't know which games use this compression,\n");
 	printf("but you can encode/decode files encoded with BTREE using this tool.\n");
-    printf("The headers used by this format can be 0x46fb or 0x47fb.\n");
+    printf("The headers used by this format can be 0x46fb or 0x47fb.\n\n");
+	printf("COMP format\n\n");
+	printf("An LZ format with a 4095 bytes window and matches of 3 to 18 bytes, stored after a 16 bytes header.\n");
+	printf("Like REF, it accepts an optional level before the infile:\n");
+	printf("-0: greedy parse, the default\n");
+	printf("-1: optimal parse. Slower, but gives the best ratio\n");
 }
 
@@ -7,7 +7,9 @@ i686-w64-mingw32-g++ \
 	-IBTREE \
 	-IJDLZ \
 	-ICOMP \
+	-IMATCH \
 	-fexec-charset=ISO-8859-1 \
+	-pthread \
 	-static-libgcc \
 	-static-libstdc++ \
 	-static \